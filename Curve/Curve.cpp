@@ -6,16 +6,23 @@
 #include "pluginterfaces/base/ibstream.h"
 #include "base/source/fstreamer.h"
 
+#include <algorithm>
+
 #include "Curve.h"
 #include "CurveController.h"
 #include "interpolate.h"
+#include "state.h"
 
 // Return the first time strictly after t when a new segment of the automation
 // curve starts (or INT32_MAX if no segments start after t).
 // Also reposition the index to the point at time offset t (or the total number of segments).
 int32 StatefulParamQueue::next_segment_start(int32 t, ParamValue& y)
 {
-	if (!q) return INT32_MAX;
+	if (!q)
+	{
+		y = init_y;
+		return INT32_MAX;
+	}
 
 	int32 n = q->getPointCount();
 	if (n < 0) n = 0; // should never happen (host provided bad point count)
@@ -64,6 +71,9 @@ int32 StatefulParamQueue::next_segment_start(int32 t, ParamValue& y)
 
 ParamValue StatefulParamQueue::value_at(int32 t)
 {
+	if (!q)
+		return init_y;
+
 	ParamValue y1;
 	int32 t1 = next_segment_start(t, y1);
 	int32 t0 = -1;
@@ -73,13 +83,134 @@ ParamValue StatefulParamQueue::value_at(int32 t)
 	return interpolate(t0, y0, t1, y1, t);
 }
 
+// Return the first time strictly after t when the automation curve starts a new segment or crosses a multiple of
+// 1/divisions (or INT32_MAX if it does neither).
+int32 StatefulParamQueue::next_crossing(int32 t, int32 divisions)
+{
+	ParamValue y1;
+	const int32 t1 = next_segment_start(t, y1);
+	int32 t0 = -1;
+	ParamValue y0 = init_y;
+	if (index > 0)
+		q->getPoint(index - 1, t0, y0);
+	if (t1 == INT32_MAX || y0 == y1)
+		return t1;
+
+	const ParamValue s0 = y0 * (ParamValue)divisions;
+	const ParamValue s1 = y1 * (ParamValue)divisions;
+	// Not interpolate(), which clamps to [0,1] and so would stop s at 1 when divisions > 1.
+	const ParamValue s = s0 + (s1 - s0) * ((ParamValue)(t - t0) / (ParamValue)(t1 - t0));
+	const ParamValue b = (s0 < s1) ? std::floor(s) + 1. : std::ceil(s) - 1.;
+	if ((s0 < s1) ? (b > s1) : (b < s1))
+		return t1;
+
+	int32 t_b = (int32)std::round((ParamValue)t0 + (ParamValue)(t1 - t0) * ((b - s0) / (s1 - s0)));
+	if (t_b <= t) t_b = t + 1;
+	if (t_b > t1) t_b = t1;
+	return t_b;
+}
+
+// Return the index of the last point whose x-coordinate is at most x.
+int32 CurveFunction::floor_point(ParamValue x) const
+{
+	int32 cp;
+	if (this->x)
+		cp = (int32)(std::upper_bound(this->x, this->x + n, x) - this->x) - 1;
+	else
+		cp = (int32)(std::floor(x * (ParamValue)(n - 1)) + 0.1);
+	if (cp < 0) cp = 0; else if (cp >= n) cp = n - 1;
+	return cp;
+}
+
+// Return the index of the first point whose x-coordinate is at least x.
+int32 CurveFunction::ceil_point(ParamValue x) const
+{
+	int32 cp;
+	if (this->x)
+		cp = (int32)(std::lower_bound(this->x, this->x + n, x) - this->x);
+	else
+		cp = (int32)(std::ceil(x * (ParamValue)(n - 1)) + 0.1);
+	if (cp < 0) cp = 0; else if (cp >= n) cp = n - 1;
+	return cp;
+}
+
+ParamValue CurveFunction::point_x(int32 cp) const
+{
+	return x ? x[cp] : (ParamValue)cp / (ParamValue)(n - 1);
+}
+
+ParamValue CurveFunction::point_y(int32 cp, int32 t)
+{
+	const ParamValue y_cp = y_auto ? y_auto[cp].value_at(t) : y[cp];
+	return morph ? morph->point_y(cp, y_cp, t) : y_cp;
+}
+
+// Return the first time strictly after t when the y-coordinate of point cp starts a new linear segment.
+int32 CurveFunction::next_change(int32 cp, int32 t)
+{
+	ParamValue dummy;
+	int32 t_change = y_auto ? y_auto[cp].next_segment_start(t, dummy) : INT32_MAX;
+	if (morph)
+		t_change = std::min(t_change, morph->next_change(t));
+	return t_change;
+}
+
+// Return the value of the curve function at x and time t.
+ParamValue CurveFunction::value_at(ParamValue x, int32 t)
+{
+	const int32 cp0 = floor_point(x);
+	const int32 cp1 = ceil_point(x);
+	if (cp0 == cp1)
+		return point_y(cp0, t);
+
+	const ParamValue cp0_x = point_x(cp0);
+	const ParamValue cp1_x = point_x(cp1);
+	const ParamValue cp0_y = point_y(cp0, t);
+	const ParamValue cp1_y = point_y(cp1, t);
+	return cp0_y + (cp1_y - cp0_y) * ((x - cp0_x) / (cp1_x - cp0_x));
+}
+
+// Return the longest step from time t, at most num_samples, over which a line stays within morph_tolerance of the
+// curve function while x moves linearly from x0 to x1 within one interval and its points change linearly.
+int32 CurveFunction::max_step(ParamValue x0, ParamValue x1, int32 t, int32 num_samples)
+{
+	if (!morph)
+		return num_samples;
+	const int32 cp0 = floor_point(0.5 * (x0 + x1));
+	const int32 cp1 = ceil_point(0.5 * (x0 + x1));
+	ParamValue w0 = 0., w1 = 0.;
+	if (cp0 != cp1)
+	{
+		const ParamValue cp0_x = point_x(cp0);
+		const ParamValue cp1_x = point_x(cp1);
+		w0 = (x0 - cp0_x) / (cp1_x - cp0_x);
+		w1 = (x1 - cp0_x) / (cp1_x - cp0_x);
+	}
+	const ParamValue live0[2] = { y_auto ? y_auto[cp0].value_at(t) : y[cp0], y_auto ? y_auto[cp1].value_at(t) : y[cp1] };
+	const ParamValue live1[2] = { y_auto ? y_auto[cp0].value_at(t + num_samples) : y[cp0],
+		y_auto ? y_auto[cp1].value_at(t + num_samples) : y[cp1] };
+	return morph->max_step(cp0, cp1, w0, w1, live0, live1, t, num_samples);
+}
+
+void CurveFunction::reset()
+{
+	if (y_auto)
+	{
+		for (int32 cp = 0; cp < n; ++cp)
+			y_auto[cp].index = 0;
+	}
+	if (morph)
+		morph->reset();
+}
+
 Curve::Curve(void)
 {
 	LOG("Curve constructor called.\n");
 	setControllerClass(FUID(CurveControllerUID));
 	processSetup.maxSamplesPerBlock = INT32_MAX;
-	for (int32 i = 0; i < num_curve_points; ++i)
-		param_value[i] = (ParamValue)i / (ParamValue)num_intervals;
+	for (ParamID id = 0; id < num_params; ++id)
+		param_value[id] = (StoredValue)default_value(id);
+	snapshot.publish(param_value);
 	LOG("Curve constructor exited.\n");
 }
 
@@ -99,8 +230,11 @@ tresult PLUGIN_API Curve::initialize(FUnknown* context)
 		return result;
 	}
 
-	for (int32 i = 0; i < num_curve_points; ++i)
-		param_value[i] = (ParamValue)i / (ParamValue)num_intervals;
+	for (ParamID id = 0; id < num_params; ++id)
+		param_value[id] = (StoredValue)default_value(id);
+	composed_dirty = true;
+	routing_dirty = true;
+	snapshot.publish(param_value);
 
 	LOG("Curve::initialize exited normally.\n");
 	return kResultOk;
@@ -117,6 +251,13 @@ tresult PLUGIN_API Curve::terminate()
 tresult PLUGIN_API Curve::setActive(TBool state)
 {
 	LOG("Curve::setActive called.\n");
+	if (data_exchange)
+	{
+		if (state)
+			data_exchange->onActivate(processSetup);
+		else
+			data_exchange->onDeactivate();
+	}
 	tresult result = AudioEffect::setActive(state);
 	LOG("Curve::setActive exited with code %d.\n", result);
 	return result;
@@ -135,80 +276,110 @@ tresult PLUGIN_API Curve::setProcessing(TBool state)
 	return kResultOk;
 }
 
+// The host may call setState and getState on another thread while process runs on the audio thread.  Neither
+// touches param_value: setState stages the new values for process to adopt at the start of its next block, and
+// getState reads the values that process last published (or staged values it hasn't yet adopted and published).
 tresult PLUGIN_API Curve::setState(IBStream* state)
 {
 	LOG("Curve::setState called.\n");
 
+	ParamValue values[num_params];
+	if (!staged.peek(values))
+		snapshot.read(values);
+
 	IBStreamer streamer(state, kLittleEndian);
-	int32 num_in_curve_points;
-	if (!streamer.readInt32(num_in_curve_points))
+	if (!read_state(streamer, values))
 	{
-		LOG("Curve::setState unable to read curve point count.\n");
+		LOG("Curve::setState failed due to streamer error.\n");
 		return kResultFalse;
 	}
-	if (num_in_curve_points < 2)
+	staged.put(values);
+
+	LOG("Curve::setState exited successfully.\n");
+	return kResultOk;
+}
+
+tresult PLUGIN_API Curve::getState(IBStream* state)
+{
+	LOG("Curve::getState called.\n");
+
+	ParamValue values[num_params];
+	if (!staged.peek(values))
+		snapshot.read(values);
+
+	IBStreamer streamer(state, kLittleEndian);
+	if (!write_state(streamer, values))
 	{
-		LOG("Curve::setState received illegal curve point count of %d.\n", num_in_curve_points);
+		LOG("Curve::getState failed due to streamer error.\n");
 		return kResultFalse;
 	}
 
-	if (num_in_curve_points == num_curve_points)
+	LOG("Curve::getState exited successfully.\n");
+	return kResultOk;
+}
+
+// Store the final value of each curve point's automation curve and of the morph position's automation curve.
+void Curve::update_curve_points(const StatefulParamQueue (*cp_in)[num_curve_points], const StatefulParamQueue& morph_in)
+{
+	if (morph_in.q)
 	{
-		if (!streamer.readDoubleArray(param_value, num_curve_points))
+		int32 n = morph_in.q->getPointCount();
+		if (n > 0)
 		{
-			LOG("Curve::setState unable to read %u curve points.\n", num_curve_points);
-			return kResultFalse;
+			int32 dummy;
+			ParamValue y;
+			morph_in.q->getPoint(n - 1, dummy, y);
+			param_value[morph_param] = (StoredValue)y;
 		}
 	}
-	else
+
+	for (int32 stage = 0; stage < num_curve_stages; ++stage)
 	{
-		ParamValue in_curve[2] = { 0. };
-		int32 in_cp1 = -1;
-		for (int32 i = 0; i < num_curve_points; ++i)
+		for (int32 cp = 0; cp < num_curve_points; ++cp)
 		{
-			ParamValue x = (ParamValue)i / (ParamValue)num_curve_points;
-			for (; (ParamValue)in_cp1 / (ParamValue)num_in_curve_points < x; ++in_cp1)
+			if (cp_in[stage][cp].q)
 			{
-				in_curve[0] = in_curve[1];
-				if (in_cp1 < num_in_curve_points)
+				int32 n = cp_in[stage][cp].q->getPointCount();
+				if (n > 0)
 				{
-					if (!streamer.readDouble(in_curve[1]))
-					{
-						LOG("Curve::setState unable to read curve points during resizing from %d to %d points.\n", num_in_curve_points, num_curve_points);
-						return kResultFalse;
-					}
+					int32 dummy;
+					ParamValue y;
+					cp_in[stage][cp].q->getPoint(n - 1, dummy, y);
+					param_value[stage_point_param(stage, cp)] = (StoredValue)y;
 				}
 			}
-			param_value[i] = curve_y(2, in_curve, x * (ParamValue)num_in_curve_points - (ParamValue)(in_cp1 - 1));
 		}
 	}
+}
 
-	for (uint32 i = 0; i < num_curved_params; ++i)
+void RoutingTable::build(const StoredValue* values, int32 num_stages)
+{
+	for (ParamID src = 0; src < num_curved_params; ++src)
+	{
+		targets[src] = 0;
+		functions[src] = 0;
+	}
+	surface_targets = 0;
+	for (ParamID id = 0; id < num_curved_params; ++id)
 	{
-		if (!streamer.readDoubleArray(&param_value[num_curve_points + 2 * i], 2))
+		const int32 source = to_steps(values[first_source_param + id], num_curved_params);
+		out_source[id] = (int8)((source > 0) ? source - 1 : id);
+		out_source_y[id] = (int8)(to_steps(values[first_source_y_param + id], num_curved_params) - 1);
+		const int32 function = to_steps(values[first_function_param + id], num_curve_stages);
+		out_function[id] = (int8)((function > 0) ? function - 1 : (num_stages > 1) ? composed_function : 0);
+		if (out_source_y[id] >= 0)
 		{
-			LOG("Curve::setState stopped early with %dx3 curved params read.\n", i);
-			return kResultOk;
+			surface_targets |= 1u << id;
+			continue;
 		}
+		targets[out_source[id]] |= 1u << id;
+		functions[out_source[id]] |= (uint8)(1u << out_function[id]);
 	}
-
-	LOG("Curve::setState exited successfully.\n");
-	return kResultOk;
 }
 
-tresult PLUGIN_API Curve::getState(IBStream* state)
+int32 Curve::active_stages() const
 {
-	LOG("Curve::getState called.\n");
-
-	IBStreamer streamer(state, kLittleEndian);
-	if (!streamer.writeInt32(num_curve_points) || !streamer.writeDoubleArray(param_value, num_params))
-	{
-		LOG("Curve::getState failed due to streamer error.\n");
-		return kResultFalse;
-	}
-
-	LOG("Curve::getState exited successfully.\n");
-	return kResultOk;
+	return 1 + to_steps(param_value[stages_param], num_curve_stages - 1);
 }
 
 tresult PLUGIN_API Curve::setupProcessing(ProcessSetup& newSetup)
@@ -242,11 +413,88 @@ tresult PLUGIN_API Curve::getRoutingInfo(RoutingInfo& inInfo, RoutingInfo& outIn
 	}
 }
 
+// The processor sends metering blocks to the controller through the SDK's data exchange, which uses the host's
+// IDataExchangeHandler queue where available and falls back to messages sent from a timer otherwise.  Blocks are
+// preallocated when the processor is activated, so process() never allocates.
+tresult PLUGIN_API Curve::connect(IConnectionPoint* other)
+{
+	LOG("Curve::connect called.\n");
+	tresult result = AudioEffect::connect(other);
+	if (result == kResultTrue)
+	{
+		data_exchange = std::make_unique<DataExchangeHandler>(this,
+			[](DataExchangeHandler::Config& config, const ProcessSetup&) {
+				config.blockSize = sizeof(MeterBlock);
+				config.numBlocks = 8;
+				config.alignment = 32;
+				config.userContextID = 0;
+				return true;
+			});
+		data_exchange->onConnect(other, getHostContext());
+	}
+	LOG("Curve::connect exited with code %d.\n", result);
+	return result;
+}
+
+tresult PLUGIN_API Curve::disconnect(IConnectionPoint* other)
+{
+	LOG("Curve::disconnect called.\n");
+	if (data_exchange)
+	{
+		data_exchange->onDisconnect(other);
+		data_exchange.reset();
+	}
+	tresult result = AudioEffect::disconnect(other);
+	LOG("Curve::disconnect exited with code %d.\n", result);
+	return result;
+}
+
+void MeterWriter::begin(MeterBlock* b, int32 num_samples)
+{
+	block = b;
+	if (!block)
+		return;
+	block->num_points = 0;
+	spacing = std::max(num_samples / (int32)meter_points_per_pair, 1);
+	std::fill(std::begin(count), std::end(count), 0);
+	std::fill(std::begin(next_t), std::end(next_t), 0);
+}
+
+// Record point (x,y) of an out-parameter at time t.  Points closer than the spacing to the pair's previous point, or
+// beyond its budget, replace the previous point so that the block always ends with the pair's latest values.
+void MeterWriter::add(ParamID pair, int32 t, ParamValue x, ParamValue y)
+{
+	if (!block)
+		return;
+	uint32 slot;
+	if (count[pair] > 0 && (t < next_t[pair] || count[pair] >= meter_points_per_pair))
+		slot = last[pair];
+	else if (block->num_points < max_meter_points)
+	{
+		slot = last[pair] = block->num_points++;
+		++count[pair];
+		next_t[pair] = t + spacing;
+	}
+	else
+		return;
+	MeterPoint& p = block->points[slot];
+	p.pair = pair;
+	p.sample_offset = t;
+	p.x = (float)x;
+	p.y = (float)y;
+}
+
 tresult PLUGIN_API Curve::process(ProcessData& data)
 {
 	if (data.numSamples < 0)
 		return kResultFalse;
 
+	// Adopt (and publish) any state staged by setState since the last block.  Otherwise stored values only change if
+	// the host sent parameter changes, so idle blocks needn't republish them.
+	if (staged.take(param_value, snapshot))
+		composed_dirty = routing_dirty = true;
+	bool values_changed = data.inputParameterChanges && data.inputParameterChanges->getParameterCount() > 0;
+
 	// We shouldn't be asked for any audio, but process it anyway (emit silence) to tolerate uncompliant hosts.
 	const bool is32bit = (data.symbolicSampleSize == kSample32);
 	const size_t buffersize = data.numSamples * (is32bit ? sizeof(Sample32) : sizeof(Sample64));
@@ -278,18 +526,38 @@ tresult PLUGIN_API Curve::process(ProcessData& data)
 					if (id < num_params && numPoints > 0)
 					{
 						int32 dummy;
-						q->getPoint(numPoints - 1, dummy, param_value[id]);
+						ParamValue value;
+						q->getPoint(numPoints - 1, dummy, value);
+						param_value[id] = (StoredValue)value;
+						composed_dirty = routing_dirty = true;
 					}
 				}
 			}
 		}
+		if (values_changed)
+			snapshot.publish(param_value);
 		return kResultOk;
 	}
 
-	// Organize parameter change queues into arrays.
-	StatefulParamQueue cp_in[num_curve_points] = {};
+	// Quick exit for blocks without parameter changes once the initial values have been sent.  Unless a step is left
+	// pending, every out-parameter holds its value, so there is nothing to walk.
+	if (!values_changed && steps_pending == 0 && initial_values_sent)
+		return kResultOk;
+
+	// Start a new metering block if the controller is listening.
+	meter.begin(data_exchange ? (MeterBlock*)data_exchange->getCurrentOrNewBlock().data : nullptr, data.numSamples);
+
+	// Attach this block's parameter change queues to the curve points and In/Out pairs they automate.
+	StatefulParamQueue point_in[num_curve_stages][num_curve_points];
 	IParamValueQueue* param_in[num_curved_params] = {};
-	bool curve_changed = false;
+	IParamValueQueue* param_out[num_curved_params] = {};
+	bool stage_changed[num_curve_stages] = {};
+	bool routing_changed = false;
+	CurveMorph morph;
+	bool morph_changed = false;
+	bool snapshot_changed = false;
+	bool steps_changed = false;
+	bool surface_changed = false;
 	if (data.inputParameterChanges)
 	{
 		const int32 numParamChanges = data.inputParameterChanges->getParameterCount();
@@ -298,19 +566,53 @@ tresult PLUGIN_API Curve::process(ProcessData& data)
 			if (IParamValueQueue* const q = data.inputParameterChanges->getParameterData(i))
 			{
 				const ParamID id = q->getParameterId();
-				if (id < num_curve_points)
+				if (id >= num_params)
+					continue;
+				const ParamSlot slot = param_table.slot[id];
+				switch (slot.kind)
 				{
-					cp_in[id].q = q;
+				case kPointParam:
+					point_in[slot.stage][slot.index].q = q;
+					if (q->getPointCount() > 0)
+						stage_changed[slot.stage] = true;
+					break;
+				case kInParam:
+					param_in[slot.index] = q;
+					break;
+				case kOutParam:
+					break;
+				case kMorphParam:
+					morph.position.q = q;
 					if (q->getPointCount() > 0)
-						curve_changed = true;
+						morph_changed = true;
+					break;
+				default:
+				{
+					// The stage count, the routing matrix, the stored snapshots, the output steps, and the surface
+					// are applied once per block.
+					const int32 numPoints = q->getPointCount();
+					if (numPoints > 0)
+					{
+						int32 dummy;
+						ParamValue value;
+						q->getPoint(numPoints - 1, dummy, value);
+						param_value[id] = (StoredValue)value;
+						if (slot.kind == kRoutingParam)
+							routing_changed = true;
+						else if (slot.kind == kSnapshotParam)
+							morph_changed = snapshot_changed = true;
+						else if (slot.kind == kStepsParam)
+							steps_changed = true;
+						else
+							surface_changed = true;
+					}
+					break;
+				}
 				}
-				else if (id < num_params && (id - num_curve_points) % 2 == 0)
-					param_in[(id - num_curve_points) / 2] = q;
 			}
 		}
 	}
 
-	IParamValueQueue* param_out[num_curved_params] = {};
 	if (data.outputParameterChanges)
 	{
 		const int32 numParamChanges = data.outputParameterChanges->getParameterCount();
@@ -319,110 +621,319 @@ tresult PLUGIN_API Curve::process(ProcessData& data)
 			if (IParamValueQueue* const q = data.outputParameterChanges->getParameterData(i))
 			{
 				const ParamID id = q->getParameterId();
-				if ((num_curve_points <= id) && (id < num_params) && ((id - num_curve_points) % 2 == 1))
-					param_out[(id - num_curve_points) / 2] = q;
+				if (id < num_params && param_table.slot[id].kind == kOutParam)
+					param_out[param_table.slot[id].index] = q;
 			}
 		}
 	}
 
-	// Initialize automation curves for curve function points from saved values.
-	for (int32 cp = 0; cp < num_curve_points; ++cp)
-		cp_in[cp].init_y = param_value[cp];
+	// Set up the curve functions that out-parameters can be routed through.  Each stage on its own is walked with
+	// sample-accurate automation of its points.  The chain of active stages is walked as one precomputed function,
+	// so changes to its points take effect at the start of the block in which they occur.
+	CurveFunction functions[num_curve_functions];
+	bool function_changed[num_curve_functions] = {};
+	for (int32 stage = 0; stage < num_curve_stages; ++stage)
+	{
+		// Initialize automation curves for curve function points from saved values.
+		for (int32 cp = 0; cp < num_curve_points; ++cp)
+			point_in[stage][cp].init_y = param_value[stage_point_param(stage, cp)];
+		functions[stage].y_auto = point_in[stage];
+		function_changed[stage] = stage_changed[stage];
+	}
+
+	// Morph the first stage toward the stored snapshots unless Morph is 0 throughout the block.
+	morph.position.init_y = param_value[morph_param];
+	if (morph.position.init_y != 0. || (morph.position.q && morph.position.q->getPointCount() > 0))
+	{
+		morph.prepare(param_value, stage_changed[0]);
+		functions[0].morph = &morph;
+		if (morph_changed)
+			function_changed[0] = true;
+	}
+
+	const int32 num_stages = active_stages();
+	for (int32 stage = 0; stage < num_stages; ++stage)
+	{
+		if (function_changed[stage])
+		{
+			function_changed[composed_function] = true;
+			composed_dirty = true;
+		}
+	}
+	if (routing_changed)
+		composed_dirty = true;
+	if (num_stages > 1)
+	{
+		if (composed_dirty)
+		{
+			update_curve_points(point_in, morph.position);
+			StoredValue first_stage[num_curve_points];
+			morph_points(param_value, param_value[morph_param], first_stage);
+			composed.compose(num_stages, param_value, first_stage);
+			composed_dirty = false;
+		}
+		functions[composed_function].n = composed.n;
+		functions[composed_function].x = composed.x;
+		functions[composed_function].y = composed.y;
+	}
+
+	// Changes that take effect at the start of the block have no automation points to split the walk at, so curve
+	// functions affected by them are evaluated at time 0 as well.
+	bool function_restarted[num_curve_functions] = {};
+	for (int32 f = 0; f < num_curve_functions; ++f)
+		function_restarted[f] = routing_changed || steps_changed;
+	if (function_changed[composed_function])
+		function_restarted[composed_function] = true;
+	if (functions[0].morph && snapshot_changed)
+		function_restarted[0] = true;
+
+	// Look up the in-parameters and curve function that drive each out-parameter.  Out-parameters with a Y source
+	// are driven through the surface instead of a curve function.
+	if (routing_changed || routing_dirty)
+	{
+		routing.build(param_value, num_stages);
+		routing_dirty = false;
+	}
+	const int8* const out_source = routing.out_source;
+	const int8* const out_source_y = routing.out_source_y;
+	const int8* const out_function = routing.out_function;
+	uint8 changed_functions = 0;
+	for (int32 f = 0; f < num_curve_functions; ++f)
+		if (function_changed[f])
+			changed_functions |= (uint8)(1u << f);
+
+	// Output point (t,y) of out-parameter id, driven by an in-parameter at x.  The walkers store every value they
+	// output (including steps left pending by the last block), so the stored values need publishing.
+	auto output = [&](ParamID id, int32 t, ParamValue x, ParamValue y)
+	{
+		values_changed = true;
+		int32 dummy;
+		if (!param_out[id] && data.outputParameterChanges)
+			param_out[id] = data.outputParameterChanges->addParameterData(num_curve_points + 1 + 2 * id, dummy);
+		if (param_out[id])
+			param_out[id]->addPoint(t, y, dummy);
+		meter.add(id, t, x, y);
+	};
+
+	// Output the changes of stepped out-parameter id up to unquantized point (t,y).  Each change is preceded by the
+	// previous step so that the host doesn't ramp between them, and changes that fall after this block are output at
+	// the start of the next one.  x_at(t) is the value of the driving in-parameter at time t.
+	auto output_steps = [&](ParamID id, StepQuantizer& quantizer, int32& last_t, int32 t, ParamValue y, auto x_at)
+	{
+		int32 t_step;
+		ParamValue y_step;
+		while (quantizer.step(t, y, t_step, y_step))
+		{
+			if (t_step >= data.numSamples)
+			{
+				steps_pending |= 1u << id;
+				continue;
+			}
+			if (t_step > last_t + 1)
+				output(id, t_step - 1, x_at(t_step - 1), param_value[num_curve_points + 2 * id + 1]);
+			output(id, t_step, x_at(t_step), y_step);
+			param_value[num_curve_points + 2 * id + 1] = (StoredValue)y_step;
+			last_t = t_step;
+		}
+	};
 
-	// Sample-accurate translation of each in-parameter to each out-parameter:
+	// Sample-accurate translation of pairs of in-parameters to the out-parameters they drive through the surface.
+	// Within one cell of the grid, the surface is bilinear in the two in-parameters, so the walk splits where either
+	// in-parameter's automation curve starts a new segment or crosses a grid line.  While both move, the output is
+	// quadratic in time between those points, so the walk also splits often enough to stay within surface_tolerance.
+	// This runs before the in-parameters' stored values are advanced by the curve-function walk below.
 	for (ParamID id = 0; id < num_curved_params; ++id)
 	{
-		// Quick exit for parameters that didn't change.
-		const int32 n = param_in[id] ? param_in[id]->getPointCount() : 0;
-		if (n <= 0 && !curve_changed)
+		if (!(routing.surface_targets & (1u << id)))
+			continue;
+		StatefulParamQueue in_x{ param_in[out_source[id]], param_value[num_curve_points + 2 * out_source[id]] };
+		StatefulParamQueue in_y{ param_in[out_source_y[id]], param_value[num_curve_points + 2 * out_source_y[id]] };
+		if (!routing_changed && !surface_changed && !steps_changed && !(steps_pending & (1u << id)) &&
+			!(in_x.q && in_x.q->getPointCount() > 0) && !(in_y.q && in_y.q->getPointCount() > 0))
 			continue;
 
+		StepQuantizer quantizer;
+		int32 last_t = -1;
+		const int32 steps = to_steps(param_value[first_steps_param + id], max_output_steps);
+		if (steps > 0)
+			quantizer.begin(steps, param_value[first_hysteresis_param + id], param_value[num_curve_points + 2 * id + 1], surface_z(param_value, in_x.init_y, in_y.init_y));
+		steps_pending &= ~(1u << id);
+
+		int32 t = -1;
+		do
+		{
+			int32 t_next = std::min(in_x.next_crossing(t, num_surface_points - 1), in_y.next_crossing(t, num_surface_points - 1));
+			if (t_next > data.numSamples) t_next = data.numSamples;
+			if (t < 0 && (routing_changed || surface_changed || steps_changed))
+				t_next = 0;
+			else if (t_next - t > 1)
+			{
+				// Split the rest of the cell into equal steps no longer than the surface allows.
+				const int32 max_step = surface_max_step(param_value, in_x.value_at(t), in_y.value_at(t),
+					in_x.value_at(t_next), in_y.value_at(t_next), t_next - t);
+				const int32 num_steps = (t_next - t + max_step - 1) / max_step;
+				t_next = t + (t_next - t + num_steps - 1) / num_steps;
+			}
+			t = t_next;
+			const ParamValue x = in_x.value_at(t);
+			const ParamValue z = surface_z(param_value, x, in_y.value_at(t));
+			if (steps > 0)
+				output_steps(id, quantizer, last_t, t, z, [&](int32 t_x) { return in_x.value_at(t_x); });
+			else
+			{
+				if (t < data.numSamples)
+					output(id, t, x, z);
+				param_value[num_curve_points + 2 * id + 1] = (StoredValue)z;
+			}
+		} while (t < data.numSamples);
+	}
+
+	// Sample-accurate translation of each in-parameter to the out-parameters it drives:
+	for (ParamID src = 0; src < num_curved_params; ++src)
+	{
+		IParamValueQueue* const in = param_in[src];
+		const int32 n = in ? in->getPointCount() : 0;
+		const uint32 target_mask = routing.targets[src];
+
+		// Quick exit for parameters that drive nothing or that didn't change.
+		if (target_mask == 0)
+		{
+			if (n > 0)
+			{
+				int32 dummy;
+				ParamValue x;
+				in->getPoint(n - 1, dummy, x);
+				param_value[num_curve_points + 2 * src] = (StoredValue)x;
+			}
+			continue;
+		}
+		if (n == 0 && !routing_changed && !steps_changed && !(steps_pending & target_mask) &&
+			!(routing.functions[src] & changed_functions))
+			continue;
+
+		// Gather the out-parameters driven by this in-parameter, and the curve functions they use.
+		ParamID targets[num_curved_params];
+		int32 num_targets = 0;
+		for (ParamID id = 0; id < num_curved_params; ++id)
+			if (target_mask & (1u << id))
+				targets[num_targets++] = id;
+		int32 used[num_curve_functions];
+		int32 num_used = 0;
+		for (int32 f = 0; f < num_curve_functions; ++f)
+			if (routing.functions[src] & (1u << f))
+				used[num_used++] = f;
+
 		// Reset all automation curves of curve function points (for efficiency).
-		for (int32 cp = 0; cp < num_curve_points; ++cp)
-			cp_in[cp].index = 0;
+		for (int32 u = 0; u < num_used; ++u)
+			functions[used[u]].reset();
 
-		// For each segment of the in-parameter's automation curve...
+		// Start quantizing stepped out-parameters from their unquantized values at time -1.
 		int32 t0 = -1;
-		ParamValue x0 = param_value[num_curve_points + 2 * id];
+		ParamValue x0 = param_value[num_curve_points + 2 * src];
+		StepQuantizer quantizer[num_curved_params];
+		int32 last_t[num_curved_params];
+		for (int32 k = 0; k < num_targets; ++k)
+		{
+			const ParamID id = targets[k];
+			const int32 steps = to_steps(param_value[first_steps_param + id], max_output_steps);
+			if (steps > 0)
+				quantizer[k].begin(steps, param_value[first_hysteresis_param + id], param_value[num_curve_points + 2 * id + 1], functions[out_function[id]].value_at(x0, t0));
+			last_t[k] = -1;
+			steps_pending &= ~(1u << id);
+		}
+
+		// For each segment of the in-parameter's automation curve...
 		for (int32 i = 0; i <= n; ++i)
 		{
 			// Let (t0,x0)--(t1,x1) be the start and end points of this in-parameter curve segment.
 			int32 t1 = data.numSamples;
 			ParamValue x1 = x0;
 			if (i < n)
-				param_in[id]->getPoint(i, t1, x1);
+				in->getPoint(i, t1, x1);
 
 			// Line (t0,x0)--(t1,x1) spans a range of x-values bounded by a series of curve points [cp0, cp1, ...].
 			// As time progresses from t0 to t1, the values of the curve points cp0, cp1, ... might also change
 			// according to their own automation curves.  We therefore advance a point (t,x) starting at (t0,x0)
 			// through the segment to (t1,x1), finding places where line (t0,x0)--(t1,x1) crosses into new x-intervals
-			// [cp0_x,cp1_x] of the curve function, or where the automation curves for the points cp0 and cp1 that
-			// define the slope of the current curve function segment change non-linearly.
+			// [cp0_x,cp1_x] of a curve function, or where the automation curves for the points cp0 and cp1 that
+			// define the slope of the current curve function segment change non-linearly.  All curve functions
+			// driven by this in-parameter share the walk, each being evaluated only at its own events.
 			// Invariant: Point (t,x) is the previously outputted point.
-			constexpr ParamValue intervals = (ParamValue)(num_curve_points - 1);
 			int32 t = t0;
 			ParamValue x = x0;
 			do
 			{
-				// Let (t_cp, x_cp) be the point at the next time t_cp > t that line (t0,x0)--(t1,x1) crosses into
-				// a new interval of the curve function, or (t1,x1) if no interval boundaries are crossed.
-				int32 t_cp = t1;
-				const ParamValue x_nudged = std::nextafter(x, x1);
-				if (x0 != x1)
-				{
-					constexpr auto floord = static_cast<ParamValue(*)(ParamValue)>(std::floor);
-					constexpr auto ceild = static_cast<ParamValue(*)(ParamValue)>(std::ceil);
-					int32 cp = (x0 <= x1 ? ceild : floord)(x_nudged * intervals);
-					if (cp < 0) cp = 0; else if (num_curve_points <= cp) cp = num_curve_points - 1;
-					const ParamValue x_cp = (ParamValue)cp / intervals;
-					t_cp = std::round((ParamValue)t0 + (ParamValue)(t1 - t0) * ((x_cp - x0) / (x1 - x0)));
-					if (t_cp <= t) t_cp = t + 1;
-					if (t_cp > t1) t_cp = t1;
-				}
-
-				// Find the indexes cp0 and cp1 of the curve function points that bound interval (x, x_cp].
-				int32 cp0 = (int32)(std::floor(x_nudged * intervals) + 0.1);
-				if (cp0 < 0) cp0 = 0; else if (cp0 >= num_curve_points) cp0 = num_curve_points - 1;
-				int32 cp1 = (int32)(std::ceil(x_nudged * intervals) + 0.1);
-				if (cp1 < 0) cp1 = 0; else if (cp1 >= num_curve_points) cp1 = num_curve_points - 1;
-
-				// Advance (t,x) to the earliest of the following three events:
+				// For each curve function, find the earliest of the following three events:
 				// (a) line segment (t0,x0)--(t1,x1) moves into a new interval of the curve function or ends (at t_cp),
 				// (b) bounding curve-point cp0's automation curve switches to a new linear segment (at t_cp0), or
 				// (c) bounding curve-point cp1's automation curve switches to a new linear segment (at t_cp1).
-				ParamValue y;
-				const int32 t_cp0 = cp_in[cp0].next_segment_start(t, y);
-				const int32 t_cp1 = cp_in[cp1].next_segment_start(t, y);
-				t = t_cp;
-				if (t_cp0 < t) t = t_cp0;
-				if (t_cp1 < t) t = t_cp1;
-				x = interpolate(t0, x0, t1, x1, t);
-
-				// Compute the y-value returned by the curve function for x at time t.
-				if (cp0 == cp1)
-				{
-					y = cp_in[cp0].value_at(t);
-				}
-				else
+				// Then advance (t,x) to the earliest event of any curve function.
+				const ParamValue x_nudged = std::nextafter(x, x1);
+				int32 t_event[num_curve_functions];
+				int32 t_next = t1;
+				for (int32 u = 0; u < num_used; ++u)
 				{
-					const ParamValue cp0_x = (ParamValue)cp0 / intervals;
-					const ParamValue cp1_x = (ParamValue)cp1 / intervals;
-					const ParamValue cp0_y = cp_in[cp0].value_at(t);
-					const ParamValue cp1_y = cp_in[cp1].value_at(t);
-					y = cp0_y + (cp1_y - cp0_y) * ((x - cp0_x) / (cp1_x - cp0_x));
+					CurveFunction& f = functions[used[u]];
+
+					// Let (t_cp, x_cp) be the point at the next time t_cp > t that line (t0,x0)--(t1,x1) crosses into
+					// a new interval of the curve function, or (t1,x1) if no interval boundaries are crossed.
+					int32 t_cp = t1;
+					if (x0 != x1)
+					{
+						const int32 cp = (x0 <= x1) ? f.ceil_point(x_nudged) : f.floor_point(x_nudged);
+						const ParamValue x_cp = f.point_x(cp);
+						t_cp = std::round((ParamValue)t0 + (ParamValue)(t1 - t0) * ((x_cp - x0) / (x1 - x0)));
+						if (t_cp <= t) t_cp = t + 1;
+						if (t_cp > t1) t_cp = t1;
+					}
+
+					// Find the indexes cp0 and cp1 of the curve function points that bound interval (x, x_cp].
+					const int32 t_cp0 = f.next_change(f.floor_point(x_nudged), t);
+					const int32 t_cp1 = f.next_change(f.ceil_point(x_nudged), t);
+					if (t_cp0 < t_cp) t_cp = t_cp0;
+					if (t_cp1 < t_cp) t_cp = t_cp1;
+					if (f.morph && t_cp - t > 1)
+					{
+						// While Morph moves, the output bends between events, so split the rest of the interval into
+						// equal steps no longer than the morph allows.
+						const int32 max_step = f.max_step(x, interpolate(t0, x0, t1, x1, t_cp), t, t_cp - t);
+						const int32 num_steps = (t_cp - t + max_step - 1) / max_step;
+						t_cp = t + (t_cp - t + num_steps - 1) / num_steps;
+					}
+					if (t < 0 && function_restarted[used[u]] && t_cp > 0) t_cp = 0;
+					t_event[u] = t_cp;
+					if (t_cp < t_next) t_next = t_cp;
 				}
+				t = t_next;
+				x = interpolate(t0, x0, t1, x1, t);
 
-				// Output point (x,y) and update stored param values.
-				if (t < data.numSamples)
+				// Evaluate each curve function that has an event at time t, and output its value to the out-parameters
+				// that use it.  The outputs of the other curve functions continue linearly through time t.
+				for (int32 u = 0; u < num_used; ++u)
 				{
-					int32 dummy;
-					if (!param_out[id] && data.outputParameterChanges)
-						param_out[id] = data.outputParameterChanges->addParameterData(num_curve_points + 1 + 2 * id, dummy);
-					if (param_out[id])
-						param_out[id]->addPoint(t, y, dummy);
+					if (t_event[u] != t)
+						continue;
+					const ParamValue y = functions[used[u]].value_at(x, t);
+					for (int32 k = 0; k < num_targets; ++k)
+					{
+						const ParamID id = targets[k];
+						if (out_function[id] != used[u])
+							continue;
+
+						// Stepped out-parameters only output the samples where their step changes.
+						if (quantizer[k].steps > 0)
+						{
+							output_steps(id, quantizer[k], last_t[k], t, y, [&](int32 t_x) { return interpolate(t0, x0, t1, x1, t_x); });
+							continue;
+						}
+
+						// Output point (x,y) and update stored param values.
+						if (t < data.numSamples)
+							output(id, t, x, y);
+						param_value[num_curve_points + 2 * id + 1] = (StoredValue)y;
+					}
 				}
-				param_value[num_curve_points + 2 * id] = x;
-				param_value[num_curve_points + 2 * id + 1] = y;
+				param_value[num_curve_points + 2 * src] = (StoredValue)x;
 			} while (t < t1);
 
 			// Progress to the next segment of in-parameter's automation curve and continue.
@@ -431,22 +942,8 @@ tresult PLUGIN_API Curve::process(ProcessData& data)
 		}
 	}
 
-	// Update stored curve-point values for the next call to process().
-	if (curve_changed)
-	{
-		for (int32 cp = 0; cp < num_curve_points; ++cp)
-		{
-			if (cp_in[cp].q)
-			{
-				int32 n = cp_in[cp].q->getPointCount();
-				if (n > 0)
-				{
-					int32 dummy;
-					cp_in[cp].q->getPoint(n - 1, dummy, param_value[cp]);
-				}
-			}
-		}
-	}
+	// Update stored curve-point and morph values for the next call to process().
+	update_curve_points(point_in, morph.position);
 
 	// Force-output initial values on first call to process(), to help hosts sync up.
 	if (data.outputParameterChanges && !initial_values_sent)
@@ -462,5 +959,10 @@ tresult PLUGIN_API Curve::process(ProcessData& data)
 		initial_values_sent = true;
 	}
 
+	if (meter.block && meter.block->num_points > 0)
+		data_exchange->sendCurrentBlock();
+
+	if (values_changed)
+		snapshot.publish(param_value);
 	return kResultOk;
 }
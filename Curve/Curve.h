@@ -8,16 +8,169 @@
 #include "pluginterfaces/vst/ivstevents.h"
 #include "base/source/fstring.h"
 #include "pluginterfaces/base/funknown.h"
+#include "public.sdk/source/vst/utility/dataexchange.h"
+
+#include <atomic>
+#include <memory>
 
 using namespace Steinberg;
 using namespace Steinberg::Vst;
 
+// Stored parameter values are doubles by default.  Defining COMPACT_STATE (msbuild /p:CompactState=true) stores them
+// as floats instead, halving the memory and cache footprint of each instance for projects that load very many
+// instances.
+#ifdef COMPACT_STATE
+typedef float StoredValue;
+#else
+typedef ParamValue StoredValue;
+#endif
+
 constexpr ParamID num_curve_points = 11; // must be at least 2
 constexpr ParamID num_curved_params = 20;
-constexpr ParamID num_params = num_curve_points + 2 * num_curved_params;
+constexpr ParamID num_curve_stages = 3; // must be at least 1
+constexpr ParamID num_morph_snapshots = 3;
+constexpr ParamValue morph_tolerance = 1. / 4096.; // largest error of the output line segments while Morph moves
+constexpr int32 max_output_steps = 128;
+constexpr ParamID num_surface_points = 5; // per axis, must be at least 2
+constexpr ParamValue surface_tolerance = 1. / 4096.; // largest error of the output line segments in surface mode
+constexpr ParamID num_base_params = num_curve_points + 2 * num_curved_params;
+
+// Parameters introduced after v1.1 are numbered after the base parameters so that existing automation keeps its IDs.
+constexpr ParamID first_stage_param = num_base_params;
+constexpr ParamID stages_param = first_stage_param + (num_curve_stages - 1) * num_curve_points;
+constexpr ParamID first_source_param = stages_param + 1;
+constexpr ParamID first_function_param = first_source_param + num_curved_params;
+constexpr ParamID first_snapshot_param = first_function_param + num_curved_params;
+constexpr ParamID morph_param = first_snapshot_param + num_morph_snapshots * num_curve_points;
+constexpr ParamID first_steps_param = morph_param + 1;
+constexpr ParamID first_hysteresis_param = first_steps_param + num_curved_params;
+constexpr ParamID first_source_y_param = first_hysteresis_param + num_curved_params;
+constexpr ParamID first_surface_param = first_source_y_param + num_curved_params;
+constexpr ParamID num_params = first_surface_param + num_surface_points * num_surface_points;
 
 constexpr ParamID num_intervals = num_curve_points - 1;
 
+// Out-parameters can be routed through each stage on its own, or through the composition of the active stages.
+constexpr int32 num_curve_functions = num_curve_stages + 1;
+constexpr int32 composed_function = num_curve_stages;
+
+// Return the ID of curve point cp of the given stage (stage 0 is Curve0, Curve1, ...).
+constexpr ParamID stage_point_param(int32 stage, int32 cp)
+{
+	return stage == 0 ? cp : first_stage_param + (stage - 1) * num_curve_points + cp;
+}
+
+// Return the ID of curve point cp of the given stored snapshot (snapshot 0 is Snapshot1 Curve0, ...).
+constexpr ParamID snapshot_point_param(int32 snapshot, int32 cp)
+{
+	return first_snapshot_param + snapshot * num_curve_points + cp;
+}
+
+// Return the ID of the surface point at grid column ix and row iy (point 0,0 is at x=0, y=0).
+constexpr ParamID surface_point_param(int32 ix, int32 iy)
+{
+	return first_surface_param + iy * num_surface_points + ix;
+}
+
+// Return the value of parameter id in a new instance: identity curves for the stages and snapshots, the product X·Y
+// for the surface, and 0 for everything else.
+constexpr ParamValue default_value(ParamID id)
+{
+	if (id < num_curve_points)
+		return (ParamValue)id / (ParamValue)num_intervals;
+	if (id >= first_stage_param && id < stages_param)
+		return (ParamValue)((id - first_stage_param) % num_curve_points) / (ParamValue)num_intervals;
+	if (id >= first_snapshot_param && id < morph_param)
+		return (ParamValue)((id - first_snapshot_param) % num_curve_points) / (ParamValue)num_intervals;
+	if (id >= first_surface_param && id < num_params)
+	{
+		const ParamID g = id - first_surface_param;
+		return (ParamValue)((g % num_surface_points) * (g / num_surface_points))
+			/ (ParamValue)((num_surface_points - 1) * (num_surface_points - 1));
+	}
+	return 0.;
+}
+
+// Upper bound on the number of points of a composition of the given number of stages.  Each stage can split
+// every linear piece of the stages before it into at most num_intervals pieces.
+constexpr int32 max_composed_points(int32 stages)
+{
+	return stages <= 1 ? num_curve_points : num_intervals * (max_composed_points(stages - 1) - 1) + 1;
+}
+
+// Metering data sent from the processor to the controller after each block.  Each out-parameter contributes at most
+// meter_points_per_pair decimated points per block, the last of which is always its latest point.
+constexpr uint32 meter_points_per_pair = 4;
+constexpr uint32 max_meter_points = num_curved_params * meter_points_per_pair;
+
+struct MeterPoint
+{
+	uint32 pair; // index of the out-parameter (0 for Out1)
+	int32 sample_offset;
+	float x;
+	float y;
+};
+
+struct MeterBlock
+{
+	uint32 num_points;
+	MeterPoint points[max_meter_points];
+};
+
+// What each parameter ID controls, so that host parameter changes can be dispatched with a single table lookup.
+enum ParamKind : uint8
+{
+	kPointParam, // curve point index of stage
+	kInParam, // in-parameter of pair index
+	kOutParam, // out-parameter of pair index
+	kRoutingParam, // stage count or routing matrix
+	kSnapshotParam,
+	kMorphParam,
+	kStepsParam, // output steps or hysteresis
+	kSurfaceParam
+};
+
+struct ParamSlot
+{
+	ParamKind kind = kPointParam;
+	uint8 stage = 0;
+	uint8 index = 0;
+};
+
+constexpr ParamSlot param_slot(ParamID id)
+{
+	if (id < num_curve_points)
+		return { kPointParam, 0, (uint8)id };
+	if (id < num_base_params)
+		return { ((id - num_curve_points) % 2 == 0) ? kInParam : kOutParam, 0, (uint8)((id - num_curve_points) / 2) };
+	if (id < stages_param)
+		return { kPointParam, (uint8)(1 + (id - first_stage_param) / num_curve_points), (uint8)((id - first_stage_param) % num_curve_points) };
+	if (id < first_snapshot_param)
+		return { kRoutingParam, 0, 0 };
+	if (id < morph_param)
+		return { kSnapshotParam, 0, 0 };
+	if (id == morph_param)
+		return { kMorphParam, 0, 0 };
+	if (id < first_source_y_param)
+		return { kStepsParam, 0, 0 };
+	if (id < first_surface_param)
+		return { kRoutingParam, 0, 0 };
+	return { kSurfaceParam, 0, 0 };
+}
+
+struct ParamTable
+{
+	constexpr ParamTable()
+	{
+		for (ParamID id = 0; id < num_params; ++id)
+			slot[id] = param_slot(id);
+	}
+
+	ParamSlot slot[num_params] = {};
+};
+
+constexpr ParamTable param_table;
+
 static const FUID CurveProcessorUID(0x0dc477ea, 0xf2db4745, 0xbfad7285, 0x9786d4ba);
 
 struct StatefulParamQueue
@@ -25,12 +178,151 @@ struct StatefulParamQueue
 public:
 	ParamValue value_at(int32 t);
 	int32 next_segment_start(int32 t, ParamValue& y);
+	int32 next_crossing(int32 t, int32 divisions);
 
 	IParamValueQueue* q = nullptr;
 	ParamValue init_y = 0.;
 	int32 index = 0;
 };
 
+// Blends the points of the first stage from the live curve (Curve0, Curve1, ...) through each stored snapshot in turn
+// as the Morph parameter moves from 0 to 1.  The differences between consecutive snapshots are computed once per block,
+// so blending a point costs one FMA.  Morph automation is followed sample-accurately as a single timeline.
+struct CurveMorph
+{
+public:
+	void prepare(const StoredValue* values, bool live_automated);
+	ParamValue point_y(int32 cp, ParamValue live_y, int32 t);
+	int32 next_change(int32 t);
+	int32 max_step(int32 cp0, int32 cp1, ParamValue w0, ParamValue w1, const ParamValue* live0, const ParamValue* live1,
+		int32 t, int32 num_samples);
+	void reset();
+
+	StatefulParamQueue position;
+	bool live_automated = false;
+	int32 cached_t = -2;
+	int32 cached_k = 0;
+	ParamValue cached_f = 0.;
+	ParamValue base[num_morph_snapshots][num_curve_points]; // base[k] is the curve blended from by morph segment k
+	ParamValue diff[num_morph_snapshots][num_curve_points]; // diff[k] is the curve blended to minus base[k]
+};
+
+// Blend the live curve points and stored snapshots in values to the points of the first stage at the given morph value.
+void morph_points(const StoredValue* values, ParamValue morph, StoredValue* points);
+
+// Evaluate the surface through the grid of surface points in values (indexed by parameter ID) bilinearly at (x,y).
+ParamValue surface_z(const StoredValue* values, ParamValue x, ParamValue y);
+
+// Return the longest step, at most num_samples, over which a line stays within surface_tolerance of the surface in
+// values as (x,y) moves linearly from (x0,y0) to (x1,y1) in num_samples samples without leaving a cell of the grid.
+int32 surface_max_step(const StoredValue* values, ParamValue x0, ParamValue y0, ParamValue x1, ParamValue y1, int32 num_samples);
+
+// A piecewise-linear curve function as seen by the segment walker.  The x-coordinates of its points are fixed for
+// the duration of a call to process().  The y-coordinates follow automation curves if y_auto is non-null, and are
+// otherwise fixed.  If morph is non-null, they are then blended toward the stored snapshots.
+struct CurveFunction
+{
+public:
+	int32 floor_point(ParamValue x) const;
+	int32 ceil_point(ParamValue x) const;
+	ParamValue point_x(int32 cp) const;
+	ParamValue point_y(int32 cp, int32 t);
+	ParamValue value_at(ParamValue x, int32 t);
+	int32 next_change(int32 cp, int32 t);
+	int32 max_step(ParamValue x0, ParamValue x1, int32 t, int32 num_samples);
+	void reset();
+
+	int32 n = num_curve_points;
+	const StoredValue* x = nullptr; // nullptr means points are evenly spaced
+	const StoredValue* y = nullptr;
+	StatefulParamQueue* y_auto = nullptr;
+	CurveMorph* morph = nullptr;
+};
+
+// The composition of a chain of curve functions, precomputed as one piecewise-linear function.
+struct ComposedCurve
+{
+public:
+	void compose(int32 num_stages, const StoredValue* values, const StoredValue* first_stage);
+
+	int32 n = 0;
+	StoredValue x[max_composed_points(num_curve_stages)];
+	StoredValue y[max_composed_points(num_curve_stages)];
+};
+
+// Which in-parameters drive which out-parameters, derived from the Source, Source Y, Curve and Stages parameters.  It
+// is rebuilt only when those change, so that blocks without changes skip each in-parameter after a few mask tests.
+struct RoutingTable
+{
+public:
+	void build(const StoredValue* values, int32 num_stages);
+
+	int8 out_source[num_curved_params] = {};
+	int8 out_source_y[num_curved_params] = {};
+	int8 out_function[num_curved_params] = {};
+	uint32 targets[num_curved_params] = {}; // per in-parameter, the out-parameters it drives through a curve function
+	uint8 functions[num_curved_params] = {}; // per in-parameter, the curve functions those out-parameters use
+	uint32 surface_targets = 0; // out-parameters driven through the surface
+};
+
+static_assert(num_curved_params <= 32 && num_curve_functions <= 8, "RoutingTable masks are too narrow");
+
+// Quantizes an out-parameter's output to a number of evenly spaced steps.  The output moves to the next step only when
+// the unquantized value passes the current step by half a step plus the hysteresis (a fraction of a step), so that
+// values hovering near a boundary don't chatter.  The unquantized value is followed as a series of linear pieces,
+// and the sample offsets where the quantized value changes are solved for directly.
+struct StepQuantizer
+{
+public:
+	void begin(int32 steps, ParamValue hysteresis, ParamValue out_y, ParamValue y);
+	bool step(int32 t1, ParamValue y1, int32& t, ParamValue& y);
+
+	int32 steps = 0;
+	ParamValue band = 0.5;
+	int32 level = 0;
+	int32 t0 = -1;
+	ParamValue u0 = 0.;
+	int32 t_pending = INT32_MAX;
+};
+
+// Parameter values published by the audio thread at the end of each block, so that other threads can read a
+// consistent copy without blocking it.  Readers retry if the audio thread publishes while they are copying.
+struct StateSnapshot
+{
+public:
+	void publish(const StoredValue* values);
+	void read(ParamValue* values) const;
+
+	std::atomic<uint32> sequence{ 0 };
+	std::atomic<StoredValue> value[num_params];
+};
+
+// Parameter values handed from setState to the audio thread, which adopts them at the start of its next block.
+struct StagedState
+{
+public:
+	void put(const ParamValue* values);
+	bool peek(ParamValue* values);
+	bool take(StoredValue* values, StateSnapshot& snapshot);
+
+	enum : uint32 { kEmpty, kWriting, kReady, kReading };
+	std::atomic<uint32> status{ kEmpty };
+	StoredValue value[num_params];
+};
+
+// Collects the metering points of one block into a preallocated MeterBlock.
+struct MeterWriter
+{
+	void begin(MeterBlock* block, int32 num_samples);
+	void add(ParamID pair, int32 t, ParamValue x, ParamValue y);
+
+	MeterBlock* block = nullptr;
+	int32 spacing = 1;
+	uint32 count[num_curved_params] = {};
+	int32 next_t[num_curved_params] = {};
+	uint32 last[num_curved_params] = {};
+};
+
 class Curve : public AudioEffect
 {
 public:
@@ -52,11 +344,28 @@ public:
 	tresult PLUGIN_API setState(IBStream* state);
 	tresult PLUGIN_API getState(IBStream* state);
 	tresult PLUGIN_API canProcessSampleSize(int32 symbolicSampleSize);
+	tresult PLUGIN_API connect(IConnectionPoint* other);
+	tresult PLUGIN_API disconnect(IConnectionPoint* other);
 	~Curve(void);
 
 protected:
-	ParamValue param_value[num_params];
+	void update_curve_points(const StatefulParamQueue (*cp_in)[num_curve_points], const StatefulParamQueue& morph_in);
+	int32 active_stages() const;
+
+	// State read by every call to process(), kept together from the start of a cache line.
+	alignas(64) StoredValue param_value[num_params] = {};
+	RoutingTable routing;
+	uint32 steps_pending = 0; // out-parameters with a step left to output at the start of the next block
 	bool initial_values_sent = false;
+	bool composed_dirty = true;
+	bool routing_dirty = true;
+
+	// State only touched when values change or are handed between threads.
+	StateSnapshot snapshot;
+	StagedState staged;
+	ComposedCurve composed;
+	MeterWriter meter;
+	std::unique_ptr<DataExchangeHandler> data_exchange;
 };
 
 #ifdef LOGGING
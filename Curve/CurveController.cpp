@@ -5,6 +5,8 @@
 #include "Curve.h"
 #include "CurveController.h"
 #include "interpolate.h"
+#include "state.h"
+#include <algorithm>
 #include <string>
 
 CurveController::CurveController(void)
@@ -19,6 +21,7 @@ CurveController::~CurveController(void)
 
 tresult PLUGIN_API CurveController::queryInterface(const char* iid, void** obj)
 {
+	QUERY_INTERFACE(iid, obj, IDataExchangeReceiver::iid, IDataExchangeReceiver)
 	return EditControllerEx1::queryInterface(iid, obj);
 }
 
@@ -61,6 +64,11 @@ tresult PLUGIN_API CurveController::initialize(FUnknown* context)
 
 	addUnit(new Unit(STR16("Curve"), kCurveUnitId));
 	addUnit(new Unit(STR16("I/O Parameters"), kIOUnitId));
+	addUnit(new Unit(STR16("Curve Stages"), kStagesUnitId));
+	addUnit(new Unit(STR16("Routing"), kRoutingUnitId));
+	addUnit(new Unit(STR16("Morph"), kMorphUnitId));
+	addUnit(new Unit(STR16("Output Steps"), kStepsUnitId));
+	addUnit(new Unit(STR16("Surface"), kSurfaceUnitId));
 
 	for (int32 i = 0; i < num_curve_points; ++i)
 	{
@@ -75,6 +83,103 @@ tresult PLUGIN_API CurveController::initialize(FUnknown* context)
 		parameters.addParameter(oname, nullptr, 0, 0., ParameterInfo::kCanAutomate, num_curve_points + 2 * i + 1, kIOUnitId);
 	}
 
+	char16_t sname[32] = STR16("Stage");
+	char16_t* sindex = sname + std::char_traits<char16_t>::length(sname);
+	for (int32 stage = 1; stage < num_curve_stages; ++stage)
+	{
+		uint32_to_str16(sindex, stage + 1);
+		char16_t* scindex = sindex + std::char_traits<char16_t>::length(sindex);
+		std::char_traits<char16_t>::copy(scindex, STR16(" Curve"), 6);
+		scindex += 6;
+		for (int32 i = 0; i < num_curve_points; ++i)
+		{
+			uint32_to_str16(scindex, i);
+			parameters.addParameter(sname, nullptr, 0, (ParamValue)i / (ParamValue)num_intervals, ParameterInfo::kCanAutomate, stage_point_param(stage, i), kStagesUnitId);
+		}
+	}
+	parameters.addParameter(STR16("Stages"), nullptr, num_curve_stages - 1, 0., ParameterInfo::kCanAutomate, stages_param, kStagesUnitId);
+
+	char16_t rname[32] = STR16("Out");
+	char16_t* rindex = rname + std::char_traits<char16_t>::length(rname);
+	for (int32 i = 0; i < num_curved_params; ++i)
+	{
+		uint32_to_str16(rindex, i + 1);
+		char16_t* rsuffix = rindex + std::char_traits<char16_t>::length(rindex);
+
+		std::char_traits<char16_t>::copy(rsuffix, STR16(" Source"), 8);
+		StringListParameter* source = new StringListParameter(rname, first_source_param + i, nullptr, ParameterInfo::kCanAutomate | ParameterInfo::kIsList, kRoutingUnitId);
+		source->appendString(STR16("Paired In"));
+		for (int32 j = 0; j < num_curved_params; ++j)
+		{
+			uint32_to_str16(iindex, j + 1);
+			source->appendString(iname);
+		}
+		parameters.addParameter(source);
+
+		std::char_traits<char16_t>::copy(rsuffix, STR16(" Curve"), 7);
+		StringListParameter* function = new StringListParameter(rname, first_function_param + i, nullptr, ParameterInfo::kCanAutomate | ParameterInfo::kIsList, kRoutingUnitId);
+		function->appendString(STR16("All Stages"));
+		for (int32 stage = 0; stage < num_curve_stages; ++stage)
+		{
+			uint32_to_str16(sindex, stage + 1);
+			function->appendString(sname);
+		}
+		parameters.addParameter(function);
+	}
+
+	char16_t mname[32] = STR16("Snapshot");
+	char16_t* mindex = mname + std::char_traits<char16_t>::length(mname);
+	for (int32 snapshot = 0; snapshot < num_morph_snapshots; ++snapshot)
+	{
+		uint32_to_str16(mindex, snapshot + 1);
+		char16_t* mcindex = mindex + std::char_traits<char16_t>::length(mindex);
+		std::char_traits<char16_t>::copy(mcindex, STR16(" Curve"), 6);
+		mcindex += 6;
+		for (int32 i = 0; i < num_curve_points; ++i)
+		{
+			uint32_to_str16(mcindex, i);
+			parameters.addParameter(mname, nullptr, 0, (ParamValue)i / (ParamValue)num_intervals, ParameterInfo::kCanAutomate, snapshot_point_param(snapshot, i), kMorphUnitId);
+		}
+	}
+	parameters.addParameter(STR16("Morph"), nullptr, 0, 0., ParameterInfo::kCanAutomate, morph_param, kMorphUnitId);
+
+	for (int32 i = 0; i < num_curved_params; ++i)
+	{
+		uint32_to_str16(rindex, i + 1);
+		char16_t* rsuffix = rindex + std::char_traits<char16_t>::length(rindex);
+
+		std::char_traits<char16_t>::copy(rsuffix, STR16(" Steps"), 7);
+		parameters.addParameter(rname, nullptr, max_output_steps, 0., ParameterInfo::kCanAutomate, first_steps_param + i, kStepsUnitId);
+
+		std::char_traits<char16_t>::copy(rsuffix, STR16(" Hysteresis"), 12);
+		parameters.addParameter(rname, nullptr, 0, 0., ParameterInfo::kCanAutomate, first_hysteresis_param + i, kStepsUnitId);
+
+		std::char_traits<char16_t>::copy(rsuffix, STR16(" Source Y"), 10);
+		StringListParameter* source_y = new StringListParameter(rname, first_source_y_param + i, nullptr, ParameterInfo::kCanAutomate | ParameterInfo::kIsList, kRoutingUnitId);
+		source_y->appendString(STR16("None"));
+		for (int32 j = 0; j < num_curved_params; ++j)
+		{
+			uint32_to_str16(iindex, j + 1);
+			source_y->appendString(iname);
+		}
+		parameters.addParameter(source_y);
+	}
+
+	char16_t gname[32] = STR16("Surface X");
+	char16_t* gxindex = gname + std::char_traits<char16_t>::length(gname);
+	for (int32 iy = 0; iy < num_surface_points; ++iy)
+	{
+		for (int32 ix = 0; ix < num_surface_points; ++ix)
+		{
+			uint32_to_str16(gxindex, ix);
+			char16_t* gyindex = gxindex + std::char_traits<char16_t>::length(gxindex);
+			std::char_traits<char16_t>::copy(gyindex, STR16(" Y"), 2);
+			uint32_to_str16(gyindex + 2, iy);
+			const ParamValue z = (ParamValue)(ix * iy) / (ParamValue)((num_surface_points - 1) * (num_surface_points - 1));
+			parameters.addParameter(gname, nullptr, 0, z, ParameterInfo::kCanAutomate, surface_point_param(ix, iy), kSurfaceUnitId);
+		}
+	}
+
 	LOG("CurveController::initialize exited normally with code %d.\n", result);
 	return result;
 }
@@ -96,65 +201,60 @@ tresult PLUGIN_API CurveController::setComponentState(IBStream* state)
 		return kResultFalse;
 	}
 
+	ParamValue values[num_params];
+	for (ParamID id = 0; id < num_params; ++id)
+		values[id] = getParamNormalized(id);
+
 	IBStreamer streamer(state, kLittleEndian);
-	int32 num_in_curve_points;
-	if (!streamer.readInt32(num_in_curve_points))
-	{
-		LOG("Curve::setState unable to read curve point count.\n");
-		return kResultFalse;
-	}
-	if (num_in_curve_points < 2)
+	if (!read_state(streamer, values))
 	{
-		LOG("Curve::setState received illegal curve point count of %d.\n", num_in_curve_points);
+		LOG("CurveController::setComponentState failed due to streamer error.\n");
 		return kResultFalse;
 	}
 
-	if (num_in_curve_points == num_curve_points)
-	{
-		ParamValue vals[num_curve_points];
-		if (!streamer.readDoubleArray(vals, num_curve_points))
-		{
-			LOG("CurveController::setComponentState failed due to streamer error.\n");
-			return kResultFalse;
-		}
-		for (uint32 i = 0; i < num_curve_points; ++i)
-			setParamNormalized(i, vals[i]);
-	}
-	else
+	for (ParamID id = 0; id < num_params; ++id)
+		setParamNormalized(id, values[id]);
+
+	LOG("CurveController::setComponentState exited normally.\n");
+	return kResultOk;
+}
+
+tresult PLUGIN_API CurveController::notify(IMessage* message)
+{
+	// Metering blocks arrive as messages if the host has no data exchange queue.
+	if (data_exchange_receiver.onMessage(message))
+		return kResultOk;
+	return EditControllerEx1::notify(message);
+}
+
+void PLUGIN_API CurveController::queueOpened(DataExchangeUserContextID userContextID, uint32 blockSize, TBool& dispatchOnBackgroundThread)
+{
+	LOG("CurveController::queueOpened called with block size %u.\n", blockSize);
+	dispatchOnBackgroundThread = false;
+}
+
+void PLUGIN_API CurveController::queueClosed(DataExchangeUserContextID userContextID)
+{
+	LOG("CurveController::queueClosed called.\n");
+}
+
+// Keep the latest metered point of each out-parameter.  Blocks are only valid during this call, so copy what's needed.
+void PLUGIN_API CurveController::onDataExchangeBlocksReceived(DataExchangeUserContextID userContextID, uint32 numBlocks, DataExchangeBlock* blocks, TBool onBackgroundThread)
+{
+	for (uint32 b = 0; b < numBlocks; ++b)
 	{
-		ParamValue in_curve[2] = { 0. };
-		int32 in_cp1 = -1;
-		for (int32 i = 0; i < num_curve_points; ++i)
+		if (!blocks[b].data || blocks[b].size < sizeof(MeterBlock))
+			continue;
+		const MeterBlock* const block = (const MeterBlock*)blocks[b].data;
+		const uint32 num_points = std::min(block->num_points, max_meter_points);
+		for (uint32 i = 0; i < num_points; ++i)
 		{
-			ParamValue x = (ParamValue)i / (ParamValue)num_curve_points;
-			for (; (ParamValue)in_cp1 / (ParamValue)num_in_curve_points < x; ++in_cp1)
+			const MeterPoint& p = block->points[i];
+			if (p.pair < num_curved_params)
 			{
-				in_curve[0] = in_curve[1];
-				if (in_cp1 < num_in_curve_points)
-				{
-					if (!streamer.readDouble(in_curve[1]))
-					{
-						LOG("Curve::setState unable to read curve points during resizing from %d to %d points.\n", num_in_curve_points, num_curve_points);
-						return kResultFalse;
-					}
-				}
+				meter[p.pair] = p;
+				meter_received[p.pair] = true;
 			}
-			setParamNormalized(i, curve_y(2, in_curve, x * (ParamValue)num_in_curve_points - (ParamValue)(in_cp1 - 1)));
 		}
 	}
-
-	for (uint32 i = 0; i < num_curved_params; ++i)
-	{
-		ParamValue vals[2];
-		if (!streamer.readDoubleArray(vals, 2))
-		{
-			LOG("CurveController::setComponentState stopped early with %dx3 curved params read.\n", i);
-			return kResultOk;
-		}
-		setParamNormalized(num_curve_points + 2 * i, vals[0]);
-		setParamNormalized(num_curve_points + 2 * i + 1, vals[1]);
-	}
-
-	LOG("CurveController::setComponentState exited normally.\n");
-	return kResultOk;
 }
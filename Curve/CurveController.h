@@ -1,6 +1,9 @@
 #pragma once
 
 #include "public.sdk/source/vst/vsteditcontroller.h"
+#include "public.sdk/source/vst/utility/dataexchange.h"
+
+#include "Curve.h"
 
 using namespace Steinberg;
 using namespace Steinberg::Vst;
@@ -8,13 +11,18 @@ using namespace Steinberg::Vst;
 enum CurveUnitId : Steinberg::Vst::UnitID
 {
 	kCurveUnitId = 1,
-	kIOUnitId = 2
+	kIOUnitId = 2,
+	kStagesUnitId = 3,
+	kRoutingUnitId = 4,
+	kMorphUnitId = 5,
+	kStepsUnitId = 6,
+	kSurfaceUnitId = 7
 };
 
 
 static const FUID CurveControllerUID(0xadd77d71, 0x69d049be, 0x8aa5fa81, 0x46c747f8);
 
-class CurveController : public EditControllerEx1
+class CurveController : public EditControllerEx1, public IDataExchangeReceiver
 {
 public:
 	CurveController(void);
@@ -31,7 +39,23 @@ public:
 	tresult PLUGIN_API terminate() SMTG_OVERRIDE;
 
 	tresult PLUGIN_API setComponentState(IBStream* state) SMTG_OVERRIDE;
+	tresult PLUGIN_API notify(IMessage* message) SMTG_OVERRIDE;
+
+	void PLUGIN_API queueOpened(DataExchangeUserContextID userContextID, uint32 blockSize, TBool& dispatchOnBackgroundThread) SMTG_OVERRIDE;
+	void PLUGIN_API queueClosed(DataExchangeUserContextID userContextID) SMTG_OVERRIDE;
+	void PLUGIN_API onDataExchangeBlocksReceived(DataExchangeUserContextID userContextID, uint32 numBlocks, DataExchangeBlock* blocks, TBool onBackgroundThread) SMTG_OVERRIDE;
+
+	// Return the latest metered point of out-parameter pair, or nullptr if none has been received.
+	const MeterPoint* latest_meter_point(uint32 pair) const
+	{
+		return (pair < num_curved_params && meter_received[pair]) ? &meter[pair] : nullptr;
+	}
 
 	~CurveController(void);
+
+protected:
+	DataExchangeReceiverHandler data_exchange_receiver{ this };
+	MeterPoint meter[num_curved_params] = {};
+	bool meter_received[num_curved_params] = {};
 };
 
@@ -0,0 +1,83 @@
+#include <algorithm>
+
+#include "Curve.h"
+#include "interpolate.h"
+
+static ParamValue interpolate_x(ParamValue x0, ParamValue y0, ParamValue x1, ParamValue y1, ParamValue x)
+{
+	return y0 + (y1 - y0) * ((x - x0) / (x1 - x0));
+}
+
+// Evaluate the curve function with evenly spaced points g at x.  Unlike curve_y, this doesn't snap x to nearby points.
+static ParamValue stage_y(const StoredValue* g, ParamValue x)
+{
+	const ParamValue cp = x * (ParamValue)num_intervals;
+	int32 cp0 = (int32)cp;
+	if (cp0 < 0) cp0 = 0; else if (cp0 >= num_intervals) cp0 = num_intervals - 1;
+	ParamValue y = g[cp0] + (g[cp0 + 1] - g[cp0]) * (cp - (ParamValue)cp0);
+	if (y < 0.) y = 0.; else if (y > 1.) y = 1.;
+	return y;
+}
+
+// Precompute the composition f_{n-1} o ... o f_1 o f_0 of the first num_stages curve functions, where stage 0 is
+// applied first.  The composition of piecewise-linear functions is piecewise-linear, and its points are the points
+// of f_0 together with every x at which some earlier stage's output crosses a point of a later stage.  The points of
+// f_0 are taken from first_stage, and those of later stages from values.
+void ComposedCurve::compose(int32 num_stages, const StoredValue* values, const StoredValue* first_stage)
+{
+	for (int32 cp = 0; cp < num_curve_points; ++cp)
+	{
+		ParamValue y_cp = first_stage[cp];
+		if (y_cp < 0.) y_cp = 0.; else if (y_cp > 1.) y_cp = 1.;
+		x[cp] = (StoredValue)((ParamValue)cp / (ParamValue)num_intervals);
+		y[cp] = (StoredValue)y_cp;
+	}
+	n = num_curve_points;
+
+	for (int32 stage = 1; stage < num_stages; ++stage)
+	{
+		const StoredValue* const g = &values[stage_point_param(stage, 0)];
+
+		// Split each linear piece (xa,ya)--(xb,yb) where its y-values cross the x-coordinates of g's points.
+		// Pieces are rewritten back to front so that the new points never overwrite unread ones.
+		int32 m = max_composed_points(num_curve_stages);
+		x[--m] = x[n - 1];
+		y[m] = (StoredValue)stage_y(g, y[n - 1]);
+		for (int32 i = n - 2; i >= 0; --i)
+		{
+			const ParamValue xa = x[i], ya = y[i];
+			const ParamValue xb = x[i + 1], yb = y[i + 1];
+			for (int32 j = 1; j < num_intervals; ++j)
+			{
+				const int32 gp = (ya <= yb) ? num_intervals - j : j;
+				const ParamValue gx = (ParamValue)gp / (ParamValue)num_intervals;
+				if ((ya < gx && gx < yb) || (yb < gx && gx < ya))
+				{
+					ParamValue y_gp = g[gp];
+					if (y_gp < 0.) y_gp = 0.; else if (y_gp > 1.) y_gp = 1.;
+					x[--m] = (StoredValue)(xa + (xb - xa) * ((gx - ya) / (yb - ya)));
+					y[m] = (StoredValue)y_gp;
+				}
+			}
+			x[--m] = (StoredValue)xa;
+			y[m] = (StoredValue)stage_y(g, ya);
+		}
+
+		// Move the points back to the front, dropping any that don't bend the function.
+		int32 k = 0;
+		x[k] = x[m];
+		y[k] = y[m];
+		for (int32 i = m + 1; i < max_composed_points(num_curve_stages); ++i)
+		{
+			const ParamValue xi = x[i], yi = y[i];
+			if (xi <= x[k])
+				continue;
+			if (k > 0 && std::abs(y[k] - interpolate_x(x[k - 1], y[k - 1], xi, yi, x[k])) <= small_double * small_double)
+				--k;
+			++k;
+			x[k] = (StoredValue)xi;
+			y[k] = (StoredValue)yi;
+		}
+		n = k + 1;
+	}
+}
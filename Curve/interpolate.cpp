@@ -1,3 +1,5 @@
+#include <cmath>
+
 #include "interpolate.h"
 
 ParamValue interpolate(int32 x0, ParamValue y0, int32 x1, ParamValue y1, int32 x)
@@ -24,7 +26,7 @@ ParamValue curve_y(int32 n, const ParamValue* curve, ParamValue x)
 	ParamValue cp = x * (ParamValue)(n - 1);
 	int32 cp1 = (int32)(cp + 0.5); // round to nearest int
 	ParamValue y;
-	if (abs(cp - (ParamValue)cp1) <= small_double)
+	if (std::abs(cp - (ParamValue)cp1) <= small_double)
 	{
 		y = curve[cp1];
 	}
@@ -38,3 +40,11 @@ ParamValue curve_y(int32 n, const ParamValue* curve, ParamValue x)
 	if (y < 0.) y = 0.; else if (y > 1.) y = 1.;
 	return y;
 }
+
+// Convert the normalized value of a discrete parameter to its step number in [0, step_count].
+int32 to_steps(ParamValue value, int32 step_count)
+{
+	int32 step = (int32)(value * (ParamValue)step_count + 0.5);
+	if (step < 0) step = 0; else if (step > step_count) step = step_count;
+	return step;
+}
@@ -8,3 +8,4 @@ constexpr ParamValue small_double = 0.00001;
 
 ParamValue interpolate(int32 x0, ParamValue y0, int32 x1, ParamValue y1, int32 x);
 ParamValue curve_y(int32 n, const ParamValue* curve, ParamValue x);
+int32 to_steps(ParamValue value, int32 step_count);
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Curve.h"
+
+// Find the morph segment k (blending from curve k to curve k+1, where curve 0 is the live curve) and the fraction f
+// of the way through it at the given morph value.
+static void morph_segment(ParamValue morph, int32& k, ParamValue& f)
+{
+	const ParamValue s = morph * (ParamValue)num_morph_snapshots;
+	k = (int32)s;
+	if (k < 0) k = 0; else if (k >= (int32)num_morph_snapshots) k = num_morph_snapshots - 1;
+	f = s - (ParamValue)k;
+}
+
+void morph_points(const StoredValue* values, ParamValue morph, StoredValue* points)
+{
+	int32 k;
+	ParamValue f;
+	morph_segment(morph, k, f);
+	for (int32 cp = 0; cp < num_curve_points; ++cp)
+	{
+		const ParamValue y0 = (k == 0) ? values[cp] : values[snapshot_point_param(k - 1, cp)];
+		const ParamValue y1 = values[snapshot_point_param(k, cp)];
+		points[cp] = (StoredValue)(y0 + f * (y1 - y0));
+	}
+}
+
+// Precompute the curve blended from and the difference to the curve blended to for each morph segment.  The live curve
+// only enters segment 0; if its points are automated during the block, segment 0 is blended from the live values.
+void CurveMorph::prepare(const StoredValue* values, bool live_automated)
+{
+	for (int32 k = 0; k < (int32)num_morph_snapshots; ++k)
+	{
+		for (int32 cp = 0; cp < num_curve_points; ++cp)
+		{
+			base[k][cp] = (k == 0) ? values[cp] : values[snapshot_point_param(k - 1, cp)];
+			diff[k][cp] = values[snapshot_point_param(k, cp)] - base[k][cp];
+		}
+	}
+	this->live_automated = live_automated;
+	reset();
+}
+
+// Return the morphed y-coordinate of point cp at time t, given the live curve's y-coordinate live_y at time t.
+ParamValue CurveMorph::point_y(int32 cp, ParamValue live_y, int32 t)
+{
+	if (t != cached_t)
+	{
+		morph_segment(position.value_at(t), cached_k, cached_f);
+		cached_t = t;
+	}
+	if (cached_k == 0 && live_automated)
+		return live_y + cached_f * (base[0][cp] + diff[0][cp] - live_y);
+	return base[cached_k][cp] + cached_f * diff[cached_k][cp];
+}
+
+// Return the first time strictly after t when the morph position starts a new linear segment of its automation curve
+// or crosses into a new morph segment.
+int32 CurveMorph::next_change(int32 t)
+{
+	return position.next_crossing(t, num_morph_snapshots);
+}
+
+// Return the longest step from time t, at most num_samples, over which a line stays within morph_tolerance of the
+// morphed curve between points cp0 and cp1, while x moves linearly from fraction w0 to fraction w1 of the way from cp0
+// to cp1 and the live y-coordinates of cp0 and cp1 move linearly from live0 to live1.  The morph position must stay
+// within one morph segment and one segment of its automation curve.
+int32 CurveMorph::max_step(int32 cp0, int32 cp1, ParamValue w0, ParamValue w1, const ParamValue* live0, const ParamValue* live1,
+	int32 t, int32 num_samples)
+{
+	const ParamValue m0 = position.value_at(t);
+	const ParamValue m1 = position.value_at(t + num_samples);
+	int32 k;
+	ParamValue f;
+	morph_segment(0.5 * (m0 + m1), k, f);
+	const ParamValue f0 = m0 * (ParamValue)num_morph_snapshots - (ParamValue)k;
+	const ParamValue f1 = m1 * (ParamValue)num_morph_snapshots - (ParamValue)k;
+
+	// Over the step, the output is bilinear in x and f, so its quadratic term is the cross term of their changes.  When
+	// blending from an automated live curve, each blended point is itself the product of f and a moving live point,
+	// and the slope difference between the points varies through the step, so bound both.
+	ParamValue a;
+	if (k == 0 && live_automated)
+	{
+		const ParamValue dl0 = live1[0] - live0[0];
+		const ParamValue dl1 = live1[1] - live0[1];
+		auto slope_diff = [&](ParamValue f, const ParamValue* live) {
+			const ParamValue s0 = dl0 + (f1 - f0) * (base[0][cp0] + diff[0][cp0] - live[0]) - f * dl0;
+			const ParamValue s1 = dl1 + (f1 - f0) * (base[0][cp1] + diff[0][cp1] - live[1]) - f * dl1;
+			return std::abs(s1 - s0);
+		};
+		a = std::abs(f1 - f0) * std::max(std::abs(dl0), std::abs(dl1))
+			+ std::abs(w1 - w0) * std::max(slope_diff(f0, live0), slope_diff(f1, live1));
+	}
+	else
+		a = std::abs((f1 - f0) * (diff[k][cp1] - diff[k][cp0]) * (w1 - w0));
+	if (a <= 4. * morph_tolerance)
+		return num_samples;
+	const int32 step = (int32)((ParamValue)num_samples * 2. * std::sqrt(morph_tolerance / a));
+	return (step < 1) ? 1 : step;
+}
+
+void CurveMorph::reset()
+{
+	position.index = 0;
+	cached_t = -2;
+}
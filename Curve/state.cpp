@@ -0,0 +1,180 @@
+#include <thread>
+
+#include "state.h"
+#include "interpolate.h"
+
+// The state consists of the curve point count, the base parameters (curve points followed by In/Out pairs), and then
+// the count and values of all parameters numbered after the base parameters.  Older versions stop after the base
+// parameters, and newer versions may append parameters that this version does not know about.
+
+// Reset the values of parameters from first_absent on, which a saved state didn't include, to their defaults.  Older
+// states must load as they sounded when saved, not keep the settings of features added since.
+static bool reset_absent(ParamValue* values, ParamID first_absent)
+{
+	for (ParamID id = first_absent; id < num_params; ++id)
+		values[id] = default_value(id);
+	return true;
+}
+
+// Read a saved state into values.  Parameters absent from the state are reset to their defaults.
+bool read_state(IBStreamer& streamer, ParamValue* values)
+{
+	int32 num_in_curve_points;
+	if (!streamer.readInt32(num_in_curve_points))
+	{
+		LOG("read_state unable to read curve point count.\n");
+		return false;
+	}
+	if (num_in_curve_points < 2)
+	{
+		LOG("read_state received illegal curve point count of %d.\n", num_in_curve_points);
+		return false;
+	}
+
+	if (num_in_curve_points == num_curve_points)
+	{
+		if (!streamer.readDoubleArray(values, num_curve_points))
+		{
+			LOG("read_state unable to read %u curve points.\n", num_curve_points);
+			return false;
+		}
+	}
+	else
+	{
+		ParamValue in_curve[2] = { 0. };
+		int32 in_cp1 = -1;
+		for (int32 i = 0; i < num_curve_points; ++i)
+		{
+			ParamValue x = (ParamValue)i / (ParamValue)num_curve_points;
+			for (; (ParamValue)in_cp1 / (ParamValue)num_in_curve_points < x; ++in_cp1)
+			{
+				in_curve[0] = in_curve[1];
+				if (in_cp1 < num_in_curve_points)
+				{
+					if (!streamer.readDouble(in_curve[1]))
+					{
+						LOG("read_state unable to read curve points during resizing from %d to %d points.\n", num_in_curve_points, num_curve_points);
+						return false;
+					}
+				}
+			}
+			values[i] = curve_y(2, in_curve, x * (ParamValue)num_in_curve_points - (ParamValue)(in_cp1 - 1));
+		}
+	}
+
+	for (uint32 i = 0; i < num_curved_params; ++i)
+	{
+		if (!streamer.readDoubleArray(&values[num_curve_points + 2 * i], 2))
+		{
+			LOG("read_state stopped early with %dx2 curved params read.\n", i);
+			return reset_absent(values, num_curve_points + 2 * i);
+		}
+	}
+
+	int32 num_in_ext_params;
+	if (!streamer.readInt32(num_in_ext_params) || num_in_ext_params < 0)
+	{
+		LOG("read_state found no parameters after the base parameters.\n");
+		return reset_absent(values, num_base_params);
+	}
+	ParamID id = num_base_params;
+	for (; id < num_params && id - num_base_params < (ParamID)num_in_ext_params; ++id)
+	{
+		if (!streamer.readDouble(values[id]))
+		{
+			LOG("read_state stopped early with %u of %d extended params read.\n", id - num_base_params, num_in_ext_params);
+			return reset_absent(values, id);
+		}
+	}
+
+	return reset_absent(values, id);
+}
+
+bool write_state(IBStreamer& streamer, const ParamValue* values)
+{
+	return streamer.writeInt32(num_curve_points)
+		&& streamer.writeDoubleArray(values, num_base_params)
+		&& streamer.writeInt32(num_params - num_base_params)
+		&& streamer.writeDoubleArray(values + num_base_params, num_params - num_base_params);
+}
+
+// Publish values as the current snapshot.  Only the audio thread may call this (or any thread, while the audio thread
+// is not processing).
+void StateSnapshot::publish(const StoredValue* values)
+{
+	const uint32 seq = sequence.load(std::memory_order_relaxed);
+	sequence.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (ParamID id = 0; id < num_params; ++id)
+		value[id].store(values[id], std::memory_order_relaxed);
+	sequence.store(seq + 2, std::memory_order_release);
+}
+
+// Copy the current snapshot into values.  An odd or changed sequence number means the audio thread published during
+// the copy, so copy again.
+void StateSnapshot::read(ParamValue* values) const
+{
+	for (;;)
+	{
+		const uint32 seq = sequence.load(std::memory_order_acquire);
+		if ((seq & 1) == 0)
+		{
+			for (ParamID id = 0; id < num_params; ++id)
+				values[id] = value[id].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence.load(std::memory_order_relaxed) == seq)
+				return;
+		}
+		std::this_thread::yield();
+	}
+}
+
+// Stage values for the audio thread, replacing any values it hasn't taken yet.  Waits only while the audio thread is
+// copying previously staged values.
+void StagedState::put(const ParamValue* values)
+{
+	for (;;)
+	{
+		uint32 expected = status.load(std::memory_order_relaxed);
+		if ((expected == kEmpty || expected == kReady) &&
+			status.compare_exchange_weak(expected, kWriting, std::memory_order_acquire))
+			break;
+		std::this_thread::yield();
+	}
+	for (ParamID id = 0; id < num_params; ++id)
+		value[id] = (StoredValue)values[id];
+	status.store(kReady, std::memory_order_release);
+}
+
+// Copy the staged values without taking them, if any are waiting.  While the audio thread is taking them, wait until
+// it has published them, so that the caller never falls back to a snapshot older than the staged values.
+bool StagedState::peek(ParamValue* values)
+{
+	for (;;)
+	{
+		uint32 expected = kReady;
+		if (status.compare_exchange_strong(expected, kReading, std::memory_order_acquire))
+			break;
+		if (expected == kEmpty)
+			return false;
+		std::this_thread::yield();
+	}
+	for (ParamID id = 0; id < num_params; ++id)
+		values[id] = value[id];
+	status.store(kReady, std::memory_order_release);
+	return true;
+}
+
+// Take the staged values into values, if any are waiting, and publish them to snapshot before releasing them.  Never
+// blocks, so the audio thread may call it.
+bool StagedState::take(StoredValue* values, StateSnapshot& snapshot)
+{
+	uint32 expected = kReady;
+	if (!status.compare_exchange_strong(expected, kReading, std::memory_order_acquire))
+		return false;
+	for (ParamID id = 0; id < num_params; ++id)
+		values[id] = value[id];
+	snapshot.publish(values);
+	status.store(kEmpty, std::memory_order_release);
+	return true;
+}
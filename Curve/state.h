@@ -0,0 +1,8 @@
+#pragma once
+
+#include "base/source/fstreamer.h"
+
+#include "Curve.h"
+
+bool read_state(IBStreamer& streamer, ParamValue* values);
+bool write_state(IBStreamer& streamer, const ParamValue* values);
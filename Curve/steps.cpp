@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Curve.h"
+#include "interpolate.h"
+
+// Return whether the unquantized value u lies above (below) the band of step level.  The band of the step next to the
+// top (bottom) level is cut off at that level, so that the end levels stay reachable at full hysteresis.
+static bool above_band(ParamValue u, int32 level, int32 steps, ParamValue band)
+{
+	return level < steps && (u > (ParamValue)level + band || (level + 1 == steps && u >= (ParamValue)steps));
+}
+
+static bool below_band(ParamValue u, int32 level, ParamValue band)
+{
+	return level > 0 && (u < (ParamValue)level - band || (level == 1 && u <= 0.));
+}
+
+// Start quantizing at time -1, where the unquantized value is y and the last output value was out_y.  If out_y isn't
+// one of the steps (e.g., because quantizing was just switched on), or y lies outside the band of the step out_y,
+// the step of y is reported at time 0.
+void StepQuantizer::begin(int32 steps, ParamValue hysteresis, ParamValue out_y, ParamValue y)
+{
+	this->steps = steps;
+	band = 0.5 + 0.5 * hysteresis;
+	t0 = -1;
+	u0 = y * (ParamValue)steps;
+	t_pending = INT32_MAX;
+
+	const ParamValue l = out_y * (ParamValue)steps;
+	level = (int32)std::round(l);
+	if (level < 0) level = 0; else if (level > steps) level = steps;
+	if (std::abs(l - (ParamValue)level) > small_double)
+	{
+		level = (int32)std::round(u0);
+		if (level < 0) level = 0; else if (level > steps) level = steps;
+		t_pending = 0;
+		return;
+	}
+
+	const int32 out_level = level;
+	while (above_band(u0, level, steps, band))
+		++level;
+	while (below_band(u0, level, band))
+		--level;
+	if (level != out_level)
+		t_pending = 0;
+}
+
+// Follow the unquantized value linearly from the previous point to (t1,y1).  Return true with the time t and value y
+// of the next change of the quantized value up to time t1, or return false if there are no more.  Several steps
+// passed within the same sample are reported as one change.
+bool StepQuantizer::step(int32 t1, ParamValue y1, int32& t, ParamValue& y)
+{
+	const ParamValue u1 = y1 * (ParamValue)steps;
+	for (;;)
+	{
+		// Find the first sample at which line (t0,u0)--(t1,u1) leaves the band of the current step.
+		int32 t_cross = INT32_MAX;
+		int32 next_level = level;
+		ParamValue threshold = 0.;
+		if (u1 > u0 && above_band(u1, level, steps, band))
+		{
+			threshold = std::min((ParamValue)level + band, (ParamValue)steps);
+			next_level = level + 1;
+		}
+		else if (u1 < u0 && below_band(u1, level, band))
+		{
+			threshold = std::max((ParamValue)level - band, 0.);
+			next_level = level - 1;
+		}
+		if (next_level != level)
+		{
+			t_cross = (int32)std::floor((ParamValue)t0 + (ParamValue)(t1 - t0) * ((threshold - u0) / (u1 - u0))) + 1;
+			if (t_cross <= t0) t_cross = t0 + 1;
+			if (t_cross > t1) t_cross = t1;
+		}
+
+		// Report the pending change once no further step is passed at the same sample.
+		if (t_pending != INT32_MAX && t_cross != t_pending)
+		{
+			t = t_pending;
+			y = (ParamValue)level / (ParamValue)steps;
+			t_pending = INT32_MAX;
+			return true;
+		}
+		if (t_cross == INT32_MAX)
+			break;
+		level = next_level;
+		t_pending = t_cross;
+	}
+
+	t0 = t1;
+	u0 = u1;
+	return false;
+}
@@ -0,0 +1,48 @@
+#include <cmath>
+
+#include "Curve.h"
+
+// Find the grid interval i containing v and the fraction f of the way through it.
+static void surface_interval(ParamValue v, int32& i, ParamValue& f)
+{
+	if (v < 0.) v = 0.; else if (v > 1.) v = 1.;
+	const ParamValue g = v * (ParamValue)(num_surface_points - 1);
+	i = (int32)g;
+	if (i > (int32)num_surface_points - 2) i = num_surface_points - 2;
+	f = g - (ParamValue)i;
+}
+
+ParamValue surface_z(const StoredValue* values, ParamValue x, ParamValue y)
+{
+	int32 ix, iy;
+	ParamValue fx, fy;
+	surface_interval(x, ix, fx);
+	surface_interval(y, iy, fy);
+	const ParamValue z00 = values[surface_point_param(ix, iy)];
+	const ParamValue z10 = values[surface_point_param(ix + 1, iy)];
+	const ParamValue z01 = values[surface_point_param(ix, iy + 1)];
+	const ParamValue z11 = values[surface_point_param(ix + 1, iy + 1)];
+	const ParamValue z0 = z00 + fx * (z10 - z00);
+	const ParamValue z1 = z01 + fx * (z11 - z01);
+	return z0 + fy * (z1 - z0);
+}
+
+// Within a cell, z = z00 + fx (z10 - z00) + fy (z01 - z00) + fx fy c, where c = z11 - z10 - z01 + z00.  Moving both
+// fractions linearly makes z quadratic in time with leading coefficient a = c fx' fy', and a line through two points of
+// a quadratic L samples apart strays from it by at most |a| L^2 / 4.
+int32 surface_max_step(const StoredValue* values, ParamValue x0, ParamValue y0, ParamValue x1, ParamValue y1, int32 num_samples)
+{
+	int32 ix, iy;
+	ParamValue fx, fy;
+	surface_interval(0.5 * (x0 + x1), ix, fx);
+	surface_interval(0.5 * (y0 + y1), iy, fy);
+	const ParamValue c = values[surface_point_param(ix + 1, iy + 1)] - values[surface_point_param(ix + 1, iy)]
+		- values[surface_point_param(ix, iy + 1)] + values[surface_point_param(ix, iy)];
+	const ParamValue cells = (ParamValue)(num_surface_points - 1);
+	const ParamValue n = (ParamValue)num_samples;
+	const ParamValue a = std::abs(c * (x1 - x0) * cells * (y1 - y0) * cells) / (n * n);
+	if (a * n * n <= 4. * surface_tolerance)
+		return num_samples;
+	const int32 step = (int32)(2. * std::sqrt(surface_tolerance / a));
+	return (step < 1) ? 1 : step;
+}
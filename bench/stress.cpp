@@ -0,0 +1,275 @@
+// Stress benchmark: runs process() round-robin over many Curve instances, as a host does for a project with very
+// many tracks, and reports the memory taken per instance, the time per instance-block and (on Linux) the cache misses
+// per instance-block.  Parameter changes come from mock queues, so no host or audio device is needed.
+//
+// Usage: stress [instances] [automated pairs] [block size] [rounds]
+//
+// The defaults (2000 instances, 2 automated pairs, 512-sample blocks, 20 rounds) model a large project in which most
+// In/Out pairs sit idle.  "stress 1 20 512 20000" measures one instance whose 20 pairs are all automated.
+//
+// Build against the VST3 SDK's static libraries, e.g. with g++ from the repository root:
+//
+//   g++ -std=c++17 -O2 -DNDEBUG [-DCOMPACT_STATE] -I../vst3sdk -ICurve bench/stress.cpp Curve/Curve.cpp
+//       Curve/compose.cpp Curve/interpolate.cpp Curve/morph.cpp Curve/state.cpp Curve/steps.cpp Curve/surface.cpp
+//       -L<SDK build>/lib/Release -lsdk -lsdk_common -lbase -lpluginterfaces -lpthread -o stress
+
+#include "Curve.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(_WIN32)
+#	include <Windows.h>
+#	include <Psapi.h>
+#elif defined(__linux__)
+#	include <linux/perf_event.h>
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+
+// A parameter change queue holding a fixed list of points.
+class MockQueue : public IParamValueQueue
+{
+public:
+	MockQueue(ParamID id) : id(id) {}
+
+	ParamID PLUGIN_API getParameterId() override { return id; }
+	int32 PLUGIN_API getPointCount() override { return (int32)points.size(); }
+	tresult PLUGIN_API getPoint(int32 index, int32& sampleOffset, ParamValue& value) override
+	{
+		if (index < 0 || index >= (int32)points.size())
+			return kResultFalse;
+		sampleOffset = points[index].t;
+		value = points[index].y;
+		return kResultOk;
+	}
+	tresult PLUGIN_API addPoint(int32 sampleOffset, ParamValue value, int32& index) override
+	{
+		index = (int32)points.size();
+		points.push_back({ sampleOffset, value });
+		return kResultOk;
+	}
+
+	tresult PLUGIN_API queryInterface(const TUID, void**) override { return kNoInterface; }
+	uint32 PLUGIN_API addRef() override { return 1; }
+	uint32 PLUGIN_API release() override { return 1; }
+
+	struct Point
+	{
+		int32 t;
+		ParamValue y;
+	};
+
+	ParamID id;
+	std::vector<Point> points;
+};
+
+// The parameter changes of one block.  Output queues are preallocated, so that process() doesn't measure the
+// allocator.
+class MockChanges : public IParameterChanges
+{
+public:
+	~MockChanges()
+	{
+		for (MockQueue* q : queues)
+			delete q;
+	}
+
+	int32 PLUGIN_API getParameterCount() override { return (int32)queues.size(); }
+	IParamValueQueue* PLUGIN_API getParameterData(int32 index) override
+	{
+		return (index >= 0 && index < (int32)queues.size()) ? queues[index] : nullptr;
+	}
+	IParamValueQueue* PLUGIN_API addParameterData(const ParamID& id, int32& index) override
+	{
+		for (index = 0; index < (int32)queues.size(); ++index)
+			if (queues[index]->id == id)
+				return queues[index];
+		queues.push_back(new MockQueue(id));
+		queues.back()->points.reserve(4096);
+		return queues.back();
+	}
+
+	tresult PLUGIN_API queryInterface(const TUID, void**) override { return kNoInterface; }
+	uint32 PLUGIN_API addRef() override { return 1; }
+	uint32 PLUGIN_API release() override { return 1; }
+
+	void clear_points()
+	{
+		for (MockQueue* q : queues)
+			q->points.clear();
+	}
+
+	std::vector<MockQueue*> queues;
+};
+
+// Return the resident set size of the process in bytes, or 0 if it isn't available.
+static size_t resident_bytes()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.WorkingSetSize;
+#elif defined(__linux__)
+	if (FILE* f = fopen("/proc/self/statm", "r"))
+	{
+		unsigned long size, resident;
+		const bool ok = fscanf(f, "%lu %lu", &size, &resident) == 2;
+		fclose(f);
+		if (ok)
+			return resident * (size_t)sysconf(_SC_PAGESIZE);
+	}
+#endif
+	return 0;
+}
+
+// Counts the cache misses of this thread where the OS provides hardware counters (Linux perf events); elsewhere, or if
+// the counter can't be opened, reports none.
+class CacheMissCounter
+{
+public:
+	CacheMissCounter()
+	{
+#if defined(__linux__)
+		perf_event_attr attr = {};
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+	~CacheMissCounter()
+	{
+#if defined(__linux__)
+		if (fd >= 0)
+			close(fd);
+#endif
+	}
+
+	bool available() const { return fd >= 0; }
+
+	void start()
+	{
+#if defined(__linux__)
+		if (fd >= 0)
+		{
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	unsigned long long stop()
+	{
+		unsigned long long count = 0;
+#if defined(__linux__)
+		if (fd >= 0)
+		{
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(fd, &count, sizeof(count)) != sizeof(count))
+				count = 0;
+		}
+#endif
+		return count;
+	}
+
+private:
+	int fd = -1;
+};
+
+int main(int argc, char** argv)
+{
+	const int32 num_instances = (argc > 1) ? atoi(argv[1]) : 2000;
+	const int32 num_automated = (argc > 2) ? atoi(argv[2]) : 2;
+	const int32 block_size = (argc > 3) ? atoi(argv[3]) : 512;
+	const int32 num_rounds = (argc > 4) ? atoi(argv[4]) : 20;
+	if (num_instances < 1 || num_automated < 0 || num_automated > (int32)num_curved_params || block_size < 1 || num_rounds < 1)
+	{
+		fprintf(stderr, "usage: stress [instances] [automated pairs (0-%u)] [block size] [rounds]\n", num_curved_params);
+		return 1;
+	}
+
+	// A cycle of blocks in which the In parameters of the automated pairs ramp through a few points each.
+	constexpr int32 num_patterns = 64;
+	std::vector<MockChanges> inputs(num_patterns);
+	unsigned seed = 1;
+	auto random = [&seed]() { seed = seed * 1103515245u + 12345u; return (seed >> 8) & 0xFFFF; };
+	for (MockChanges& changes : inputs)
+	{
+		for (int32 j = 0; j < num_automated; ++j)
+		{
+			int32 index;
+			IParamValueQueue* q = changes.addParameterData(num_curve_points + 2 * j, index);
+			for (int32 p = 0; p < 4; ++p)
+				q->addPoint(p * block_size / 4 + (int32)(random() % (unsigned)(block_size / 4 + 1)) * 3 / 4, random() / 65535., index);
+		}
+	}
+	MockChanges output;
+
+	const size_t rss_before = resident_bytes();
+	std::vector<Curve*> instances(num_instances);
+	for (Curve*& c : instances)
+	{
+		c = new Curve();
+		c->initialize(nullptr);
+		c->setActive(true);
+		c->setProcessing(true);
+	}
+
+	ProcessData data;
+	data.numSamples = block_size;
+	data.symbolicSampleSize = kSample32;
+	data.outputParameterChanges = &output;
+	int32 block = 0;
+	auto run_round = [&]() {
+		for (Curve* c : instances)
+		{
+			data.inputParameterChanges = &inputs[block++ % num_patterns];
+			output.clear_points();
+			c->process(data);
+		}
+	};
+
+	// Warm up, so that the first blocks' output queue allocations and initial values aren't timed, and every page an
+	// instance touches while processing is resident.
+	run_round();
+	run_round();
+	const size_t rss_after = resident_bytes();
+
+	CacheMissCounter misses;
+	misses.start();
+	const auto start = std::chrono::steady_clock::now();
+	for (int32 r = 0; r < num_rounds; ++r)
+		run_round();
+	const auto end = std::chrono::steady_clock::now();
+	const unsigned long long num_misses = misses.stop();
+
+	const double instance_blocks = (double)num_instances * (double)num_rounds;
+	printf("instances %d, automated pairs %d, block size %d, rounds %d%s\n", num_instances, num_automated, block_size,
+		num_rounds, (sizeof(StoredValue) == sizeof(float)) ? ", COMPACT_STATE" : "");
+	printf("sizeof(Curve) %zu bytes\n", sizeof(Curve));
+	if (rss_before && rss_after)
+		printf("RSS per instance %.0f bytes\n", (double)(rss_after - rss_before) / (double)num_instances);
+	else
+		printf("RSS per instance n/a\n");
+	printf("time per instance-block %.1f ns\n", std::chrono::duration<double, std::nano>(end - start).count() / instance_blocks);
+	if (misses.available())
+		printf("cache misses per instance-block %.1f\n", (double)num_misses / instance_blocks);
+	else
+		printf("cache misses per instance-block n/a\n");
+
+	for (Curve* c : instances)
+	{
+		c->setProcessing(false);
+		c->setActive(false);
+		c->terminate();
+		c->release();
+	}
+	return 0;
+}